@@ -36,11 +36,16 @@
 #include "gstpulsevideosink.h"
 #include <string.h>
 #include <gio/gunixfdlist.h>
+#include <gio/gunixsocketaddress.h>
 #include <gst/base/gstbasesink.h>
 #include <gst/video/video.h>
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/socket.h>
 
+#include "tmpfile/wire-protocol.h"
+
 GST_DEBUG_CATEGORY_STATIC (pulsevideosink_debug);
 #define GST_CAT_DEFAULT pulsevideosink_debug
 
@@ -58,6 +63,12 @@ enum
   PROP_BUS_NAME,
   PROP_OBJECT_PATH,
   PROP_CAPS,
+  PROP_INLINE_SEND,
+  PROP_PRIORITY_STATS,
+  PROP_MAX_FRAME_AGE,
+  PROP_BURST_LATEST,
+  PROP_DIRECT_ATTACH,
+  PROP_LISTEN_FD,
 };
 
 #define gst_pulsevideo_sink_parent_class parent_class
@@ -78,9 +89,57 @@ static void gst_pulsevideo_sink_get_property (GObject * object, guint prop_id,
 static GstStateChangeReturn gst_pulsevideo_sink_change_state (
     GstElement * element, GstStateChange transition);
 static gboolean on_handle_attach (GstVideoSource2 *interface,
-    GDBusMethodInvocation *invocation, GUnixFDList* fdlist, gpointer user_data);
+    GDBusMethodInvocation *invocation, GUnixFDList* fdlist, GVariant *options,
+    gpointer user_data);
+
+static gboolean on_handle_get_client_stats (GstVideoSource2 *interface,
+    GDBusMethodInvocation *invocation, gpointer user_data);
+static void on_client_socket_removed (GstElement *socketsink, GSocket *socket,
+    gpointer user_data);
+
+static void on_caps_changed (GstPad *pad, GParamSpec *pspec,
+    gpointer user_data);
+static void finish_pending_attaches (GstPulseVideoSink *sink, GList *pending,
+    GstCaps *caps);
+
+/* How long an Attach call waits for the video to start */
+#define ATTACH_CAPS_TIMEOUT 20
+
+/* GetClientStats polls multisocketsink, which competes with the streaming
+ * thread for the clients lock, so don't do that more often than this */
+#define CLIENT_STATS_MIN_INTERVAL (G_TIME_SPAN_SECOND / 2)
+
+typedef struct {
+  GSocket *socket;
+  guint32 pid;
+  gchar *sender;
+  /* Until a "standby" client wakes up and we add it to multisocketsink */
+  GSource *standby_watch;
+  /* Once it has been added to multisocketsink */
+  gboolean in_sink;
+} ClientInfo;
+
+static ClientInfo *
+client_info_new (GSocket *socket, guint32 pid, const gchar *sender)
+{
+  ClientInfo *info = g_new0 (ClientInfo, 1);
+  info->socket = g_object_ref (socket);
+  info->pid = pid;
+  info->sender = g_strdup (sender);
+  return info;
+}
 
-static GstCaps *wait_get_caps (GstPad *pad, guint64 end_time, GError** err);
+static void
+client_info_free (ClientInfo *info)
+{
+  if (info->standby_watch) {
+    g_source_destroy (info->standby_watch);
+    g_source_unref (info->standby_watch);
+  }
+  g_object_unref (info->socket);
+  g_free (info->sender);
+  g_free (info);
+}
 
 static void
 gst_pulsevideo_sink_class_init (GstPulseVideoSinkClass * klass)
@@ -114,6 +173,38 @@ gst_pulsevideo_sink_class_init (GstPulseVideoSinkClass * klass)
       g_param_spec_string ("caps", "Caps", "Caps to use",
           "video/x-raw,format=BGR,width=1280,height=720,framerate=30/1,interlace-mode=progressive",
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT));
+  g_object_class_install_property (gobject_class, PROP_INLINE_SEND,
+      g_param_spec_boolean ("inline-send", "Inline send",
+          "Write frames to waiting clients directly from the streaming thread "
+          "rather than waking the sender thread", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PRIORITY_STATS,
+      g_param_spec_boxed ("priority-stats", "Priority stats",
+          "Send latency statistics for each client priority class",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_FRAME_AGE,
+      g_param_spec_uint64 ("max-frame-age", "Maximum frame age",
+          "Don't send clients frames that have been queued for longer than "
+          "this many nanoseconds (0 = disabled)", 0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_BURST_LATEST,
+      g_param_spec_int ("burst-latest", "Burst latest",
+          "Number of the most recent frames to send to clients as soon as "
+          "they attach (0 = wait for the next frame)", 0, G_MAXINT, 1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DIRECT_ATTACH,
+      g_param_spec_boolean ("direct-attach", "Direct attach",
+          "Listen on a unix socket so that clients can attach without going "
+          "through DBus.  Takes effect when going to READY", TRUE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_LISTEN_FD,
+      g_param_spec_int ("listen-fd", "Listen FD",
+          "An already listening abstract unix socket to use for direct "
+          "attaches, e.g. passed in by systemd socket activation.  The sink "
+          "takes ownership of it.  Takes effect when going to READY and "
+          "can't be changed in PAUSED or PLAYING.  -1 means create our own",
+          -1, G_MAXINT, -1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gst_element_class_set_static_metadata (gstelement_class,
       "PulseVideo sink", "Source/DBus",
@@ -141,9 +232,14 @@ gst_pulsevideo_sink_init (GstPulseVideoSink * this)
       "                  recover-policy=latest"
       "                  sync-method=latest"
       "                  sync=FALSE"
-      "                  enable-last-sample=FALSE",
+      "                  enable-last-sample=FALSE"
+      "                  burst-latest=1",
       TRUE, NULL, GST_PARSE_FLAG_NO_SINGLE_ELEMENT_BINS, NULL);
   gst_bin_add (GST_BIN (this), gst_object_ref (this->socketsink));
+  this->clients = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+      (GDestroyNotify) client_info_free);
+  g_signal_connect_object (this->socketsink, "client-socket-removed",
+      G_CALLBACK (on_client_socket_removed), this, 0);
   gst_element_link_many (
         this->capsfilter, this->fdpay, this->socketsink, rawvideovalidate,
         NULL);
@@ -153,13 +249,24 @@ gst_pulsevideo_sink_init (GstPulseVideoSink * this)
   gst_element_add_pad (GST_ELEMENT (this), external_pad);
   gst_object_unref (internal_pad);
 
+  internal_pad = gst_element_get_static_pad (this->fdpay, "sink");
+  g_signal_connect_object (internal_pad, "notify::caps",
+      G_CALLBACK (on_caps_changed), this, 0);
+  gst_object_unref (internal_pad);
+
 
+  this->direct_attach = TRUE;
+  this->listen_fd = -1;
   this->dbus_interface = gst_video_source2_skeleton_new ();
 
   g_signal_connect_object (this->dbus_interface,
                            "handle-attach",
                            G_CALLBACK (on_handle_attach),
                            this, 0);
+  g_signal_connect_object (this->dbus_interface,
+                           "handle-get-client-stats",
+                           G_CALLBACK (on_handle_get_client_stats),
+                           this, 0);
 }
 
 static void
@@ -183,6 +290,11 @@ gst_pulsevideo_sink_finalize (GObject * gobject)
 
   g_free (g_steal_pointer (&this->bus_name));
   g_free (g_steal_pointer (&this->object_path));
+  g_hash_table_unref (g_steal_pointer (&this->clients));
+  if (this->client_stats)
+    g_variant_unref (g_steal_pointer (&this->client_stats));
+  if (this->listen_fd >= 0)
+    close (this->listen_fd);
 
   G_OBJECT_CLASS (parent_class)->finalize (gobject);
 }
@@ -236,6 +348,38 @@ gst_pulsevideo_sink_set_property (GObject * object, guint prop_id,
       gst_caps_unref (g_steal_pointer (&caps));
       break;
     }
+    case PROP_INLINE_SEND:
+      g_object_set_property (G_OBJECT (sink->socketsink), "inline-send", value);
+      break;
+    case PROP_MAX_FRAME_AGE:
+      g_object_set_property (G_OBJECT (sink->socketsink), "max-frame-age",
+          value);
+      break;
+    case PROP_BURST_LATEST:
+      g_object_set_property (G_OBJECT (sink->socketsink), "burst-latest",
+          value);
+      break;
+    case PROP_DIRECT_ATTACH:
+      GST_OBJECT_LOCK (sink);
+      sink->direct_attach = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (sink);
+      break;
+    case PROP_LISTEN_FD: {
+      gint fd = g_value_get_int (value);
+
+      GST_OBJECT_LOCK (sink);
+      if (fd == sink->listen_fd) {
+        /* nothing to do, and we mustn't close it */
+      } else if (GST_STATE (sink) > GST_STATE_READY) {
+        GST_WARNING_OBJECT (sink, "Can't change \"listen-fd\" while running");
+      } else {
+        if (sink->listen_fd >= 0)
+          close (sink->listen_fd);
+        sink->listen_fd = fd;
+      }
+      GST_OBJECT_UNLOCK (sink);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -272,6 +416,32 @@ gst_pulsevideo_sink_get_property (GObject * object, guint prop_id,
       GST_OBJECT_UNLOCK (pulsevideosink);
       break;
     }
+    case PROP_INLINE_SEND:
+      g_object_get_property (G_OBJECT (pulsevideosink->socketsink),
+          "inline-send", value);
+      break;
+    case PROP_PRIORITY_STATS:
+      g_object_get_property (G_OBJECT (pulsevideosink->socketsink),
+          "priority-stats", value);
+      break;
+    case PROP_MAX_FRAME_AGE:
+      g_object_get_property (G_OBJECT (pulsevideosink->socketsink),
+          "max-frame-age", value);
+      break;
+    case PROP_BURST_LATEST:
+      g_object_get_property (G_OBJECT (pulsevideosink->socketsink),
+          "burst-latest", value);
+      break;
+    case PROP_DIRECT_ATTACH:
+      GST_OBJECT_LOCK (pulsevideosink);
+      g_value_set_boolean (value, pulsevideosink->direct_attach);
+      GST_OBJECT_UNLOCK (pulsevideosink);
+      break;
+    case PROP_LISTEN_FD:
+      GST_OBJECT_LOCK (pulsevideosink);
+      g_value_set_int (value, pulsevideosink->listen_fd);
+      GST_OBJECT_UNLOCK (pulsevideosink);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -287,7 +457,7 @@ gst_pulsevideo_sink_change_state (GstElement * element,
 
   sink = GST_PULSEVIDEO_SINK (element);
 
-  if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+  if (transition == GST_STATE_CHANGE_READY_TO_NULL) {
     gst_pulsevideo_sink_deregister_dbus ((GstPulseVideoSink *)element);
   }
 
@@ -295,7 +465,9 @@ gst_pulsevideo_sink_change_state (GstElement * element,
               transition)) == GST_STATE_CHANGE_FAILURE)
     goto failure;
 
-  if (transition == GST_STATE_CHANGE_READY_TO_PAUSED) {
+  /* Register as early as possible so that clients that have been waiting for
+   * us to start up can be queued while the source is starting */
+  if (transition == GST_STATE_CHANGE_NULL_TO_READY) {
     if (!gst_pulsevideo_sink_register_dbus ((GstPulseVideoSink*) element)) {
       result = GST_STATE_CHANGE_FAILURE;
       goto failure;
@@ -321,23 +493,467 @@ gst_clear_caps (GstCaps **pcaps)
   }
 }
 
+/* Translate the options passed to VideoSource2.Attach into the options
+ * understood by multisocketsink's "add-with-options" */
+static GstStructure *
+attach_options_to_structure (GVariant *options)
+{
+  GstStructure *s = gst_structure_new_empty ("options");
+  gdouble max_framerate;
+  const gchar *priority;
+  gboolean credit;
+  gint num, den;
+
+  if (g_variant_lookup (options, "max-framerate", "d", &max_framerate) &&
+      max_framerate > 0) {
+    gst_util_double_to_fraction (max_framerate, &num, &den);
+    gst_structure_set (s, "max-framerate", GST_TYPE_FRACTION, num, den, NULL);
+  }
+  if (g_variant_lookup (options, "priority", "&s", &priority))
+    gst_structure_set (s, "priority", G_TYPE_STRING, priority, NULL);
+  if (g_variant_lookup (options, "credit", "b", &credit))
+    gst_structure_set (s, "credit", G_TYPE_BOOLEAN, credit, NULL);
+  return s;
+}
+
+/* Looking up the pid of a client is done asynchronously so that it doesn't
+ * hold up other attaches */
+typedef struct {
+  GstPulseVideoSink *sink;
+  GSocket *socket;
+} PidLookup;
+
+static void
+on_caller_pid (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  PidLookup *lookup = user_data;
+  GstPulseVideoSink *sink = lookup->sink;
+  GError *err = NULL;
+  GVariant *reply;
+  ClientInfo *info;
+  guint32 pid;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res,
+      &err);
+  if (reply) {
+    g_variant_get (reply, "(u)", &pid);
+    g_variant_unref (reply);
+
+    GST_OBJECT_LOCK (sink);
+    info = g_hash_table_lookup (sink->clients, lookup->socket);
+    if (info)
+      info->pid = pid;
+    GST_OBJECT_UNLOCK (sink);
+  } else {
+    GST_WARNING_OBJECT (sink, "Failed to get pid of client: %s",
+        err->message);
+    g_clear_error (&err);
+  }
+
+  gst_object_unref (lookup->sink);
+  g_object_unref (lookup->socket);
+  g_free (lookup);
+}
+
+/* Fills in the pid of the process that made the call in the ClientInfo for
+ * @socket.  We ask the bus rather than using SO_PEERCRED on the client socket
+ * because we create both ends of that socket pair ourselves. */
+static void
+lookup_caller_pid (GstPulseVideoSink *sink, GDBusMethodInvocation *invocation,
+    GSocket *socket)
+{
+  GDBusConnection *connection =
+      g_dbus_method_invocation_get_connection (invocation);
+  const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
+  GCredentials *credentials;
+  PidLookup *lookup;
+  ClientInfo *info;
+
+  if (sender == NULL) {
+    /* peer-to-peer connection, no bus to ask */
+    credentials = g_dbus_connection_get_peer_credentials (connection);
+    if (credentials) {
+      GST_OBJECT_LOCK (sink);
+      info = g_hash_table_lookup (sink->clients, socket);
+      if (info)
+        info->pid = MAX (g_credentials_get_unix_pid (credentials, NULL), 0);
+      GST_OBJECT_UNLOCK (sink);
+    }
+    return;
+  }
+
+  lookup = g_new0 (PidLookup, 1);
+  lookup->sink = gst_object_ref (sink);
+  lookup->socket = g_object_ref (socket);
+  g_dbus_connection_call (connection, "org.freedesktop.DBus",
+      "/org/freedesktop/DBus", "org.freedesktop.DBus",
+      "GetConnectionUnixProcessID", g_variant_new ("(s)", sender),
+      G_VARIANT_TYPE ("(u)"), G_DBUS_CALL_FLAGS_NONE, 1000, NULL,
+      on_caller_pid, lookup);
+}
+
+/* An attach that is waiting for the first caps to arrive, either an Attach
+ * call or a client of our listening socket.  It is owned by its timeout
+ * source: whoever takes it off sink->pending_attaches completes it and then
+ * destroys the timeout. */
+typedef struct {
+  GstPulseVideoSink *sink;
+  GSocket *socket;              /* for multisocketsink */
+  GstStructure *options;        /* for add-with-options */
+
+  gboolean standby;
+
+  /* Attach calls */
+  GstVideoSource2 *interface;
+  GDBusMethodInvocation *invocation;
+  GUnixFDList *fdlist;
+
+  /* Direct attaches: the connection that @socket is a dup of */
+  GSocketConnection *connection;
+
+  GSource *timeout;
+} PendingAttach;
+
+static PendingAttach *
+pending_attach_new (GstPulseVideoSink *sink, GSocket *socket,
+    GVariant *options)
+{
+  PendingAttach *attach = g_new0 (PendingAttach, 1);
+  attach->sink = gst_object_ref (sink);
+  attach->socket = g_object_ref (socket);
+  attach->options = attach_options_to_structure (options);
+  g_variant_lookup (options, "standby", "b", &attach->standby);
+  return attach;
+}
+
+static void
+pending_attach_free (PendingAttach *attach)
+{
+  gst_object_unref (attach->sink);
+  g_object_unref (attach->socket);
+  gst_structure_free (attach->options);
+  g_clear_object (&attach->interface);
+  g_clear_object (&attach->fdlist);
+  g_clear_object (&attach->connection);
+  g_free (attach);
+}
+
+/* The reply to an AttachRequest.  @caps_str is NULL to tell the client to use
+ * DBus instead */
+static gboolean
+send_attach_reply (GSocketConnection *connection, const gchar *caps_str,
+    GError **error)
+{
+  GOutputStream *out =
+      g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  AttachReply reply = { ATTACH_REPLY_MAGIC, caps_str ? strlen (caps_str) : 0 };
+
+  if (!g_output_stream_write_all (out, &reply, sizeof (reply), NULL, NULL,
+          error))
+    return FALSE;
+  return reply.caps_len == 0 || g_output_stream_write_all (out, caps_str,
+      reply.caps_len, NULL, NULL, error);
+}
+
+/* Takes @error */
+static void
+fail_attach (PendingAttach *attach, GError *error)
+{
+  GstPulseVideoSink *sink = attach->sink;
+
+  GST_WARNING_OBJECT (sink, "Attach failed: %s", error->message);
+
+  GST_OBJECT_LOCK (sink);
+  g_hash_table_remove (sink->clients, attach->socket);
+  GST_OBJECT_UNLOCK (sink);
+
+  if (attach->invocation) {
+    g_dbus_method_invocation_take_error (attach->invocation, error);
+  } else {
+    send_attach_reply (attach->connection, NULL, NULL);
+    g_error_free (error);
+  }
+}
+
+typedef struct {
+  GstPulseVideoSink *sink;
+  GstStructure *options;
+} StandbyClient;
+
+static void
+standby_client_free (StandbyClient *standby)
+{
+  gst_object_unref (standby->sink);
+  gst_structure_free (standby->options);
+  g_free (standby);
+}
+
+/* The standby client has written to the socket, or closed it.  Either way
+ * multisocketsink can take it from here. */
+static gboolean
+on_standby_wakeup (GSocket *socket, GIOCondition condition,
+    gpointer user_data)
+{
+  StandbyClient *standby = user_data;
+  GstPulseVideoSink *sink = standby->sink;
+  GSource *watch = NULL;
+  ClientInfo *info;
+
+  GST_OBJECT_LOCK (sink);
+  info = g_hash_table_lookup (sink->clients, socket);
+  if (info)
+    watch = g_steal_pointer (&info->standby_watch);
+  GST_OBJECT_UNLOCK (sink);
+
+  if (watch) {
+    GST_DEBUG_OBJECT (sink, "Standby client on socket %p woke up", socket);
+    g_signal_emit_by_name (sink->socketsink, "add-with-options", socket,
+        standby->options, NULL);
+    gst_pulsevideo_sink_mark_in_sink (sink, socket);
+    g_source_unref (watch);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+/* A "standby" client only gets frames once it starts reading, which it tells
+ * us by writing to @socket.  Until then it isn't in multisocketsink at all, so
+ * an idle standby doesn't cost us anything per frame. */
+static gboolean
+is_standby_client (gpointer key, gpointer value, gpointer user_data)
+{
+  return ((ClientInfo *) value)->standby_watch != NULL;
+}
+
+/* Called after emitting add-with-options on multisocketsink for @socket.  It
+ * may have been removed again already, in which case there's nothing to do. */
+static void
+gst_pulsevideo_sink_mark_in_sink (GstPulseVideoSink *sink, GSocket *socket)
+{
+  ClientInfo *info;
+
+  GST_OBJECT_LOCK (sink);
+  info = g_hash_table_lookup (sink->clients, socket);
+  if (info)
+    info->in_sink = TRUE;
+  GST_OBJECT_UNLOCK (sink);
+}
+
+static void
+gst_pulsevideo_sink_add_standby (GstPulseVideoSink *sink, GSocket *socket,
+    const GstStructure *options)
+{
+  StandbyClient *standby = g_new0 (StandbyClient, 1);
+  GSource *watch;
+  ClientInfo *info;
+
+  standby->sink = gst_object_ref (sink);
+  standby->options = gst_structure_copy (options);
+  watch = g_socket_create_source (socket, G_IO_IN | G_IO_HUP | G_IO_ERR,
+      NULL);
+  g_source_set_callback (watch, (GSourceFunc) on_standby_wakeup, standby,
+      (GDestroyNotify) standby_client_free);
+
+  GST_OBJECT_LOCK (sink);
+  info = g_hash_table_lookup (sink->clients, socket);
+  if (info) {
+    info->standby_watch = watch;
+    g_source_attach (watch, g_main_context_get_thread_default ());
+  } else {
+    g_source_unref (watch);
+  }
+  GST_OBJECT_UNLOCK (sink);
+}
+
+static void
+complete_attach (PendingAttach *attach, const gchar *caps_str)
+{
+  static struct FaultInjectionPoint pre_attach = FAULT_INJECTION_POINT("pre_attach");
+  GstPulseVideoSink *sink = attach->sink;
+  GError *gerror = NULL;
+
+  if (!inject_fault (&pre_attach, &gerror)) {
+    fail_attach (attach, gerror);
+    return;
+  }
+
+  /* Direct clients get their frames on the same connection so the reply has
+   * to go first */
+  if (attach->connection &&
+      !send_attach_reply (attach->connection, caps_str, &gerror)) {
+    fail_attach (attach, gerror);
+    return;
+  }
+
+  if (attach->standby) {
+    gst_pulsevideo_sink_add_standby (sink, attach->socket, attach->options);
+  } else {
+    g_signal_emit_by_name (sink->socketsink, "add-with-options",
+        attach->socket, attach->options, NULL);
+    gst_pulsevideo_sink_mark_in_sink (sink, attach->socket);
+  }
+
+  if (attach->invocation)
+    gst_video_source2_complete_attach (attach->interface, attach->invocation,
+        attach->fdlist, g_variant_new_handle (0), caps_str);
+}
+
+static gboolean
+on_attach_timeout (gpointer user_data)
+{
+  PendingAttach *attach = user_data;
+  GstPulseVideoSink *sink = attach->sink;
+  GList *link;
+
+  GST_OBJECT_LOCK (sink);
+  link = g_list_find (sink->pending_attaches, attach);
+  sink->pending_attaches = g_list_delete_link (sink->pending_attaches, link);
+  GST_OBJECT_UNLOCK (sink);
+
+  if (!link) {
+    /* Raced with finish_pending_attaches which is still using @attach.  It
+     * will destroy us when it's done. */
+    return G_SOURCE_CONTINUE;
+  }
+
+  fail_attach (attach, g_error_new (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+          "Timeout waiting for caps"));
+  return G_SOURCE_REMOVE;
+}
+
+/* Completes the attaches in @pending with @caps, or fails them if @caps is
+ * NULL.  After a restart every client attaches at once so we handle them as a
+ * batch, in the order they arrived and serialising the caps only once. */
+static void
+finish_pending_attaches (GstPulseVideoSink *sink, GList *pending,
+    GstCaps *caps)
+{
+  gchar *caps_str = caps ? gst_caps_to_string (caps) : NULL;
+  GList *l;
+
+  pending = g_list_reverse (pending);
+  for (l = pending; l; l = l->next) {
+    PendingAttach *attach = l->data;
+
+    if (caps) {
+      complete_attach (attach, caps_str);
+    } else {
+      fail_attach (attach, g_error_new (G_IO_ERROR, G_IO_ERROR_CLOSED,
+              "Video source is shutting down"));
+    }
+    g_source_destroy (attach->timeout);
+  }
+  g_list_free (pending);
+  g_free (caps_str);
+}
+
+/* Completes the attaches waiting for caps now that we have them.  Direct
+ * attaches write their reply to the client socket, so this runs in the main
+ * context the attaches came in on rather than blocking the streaming thread on
+ * a slow client. */
+static gboolean
+on_finish_attaches (gpointer user_data)
+{
+  GstPulseVideoSink *sink = user_data;
+  GstPad *inpad = gst_element_get_static_pad (sink->fdpay, "sink");
+  GList *pending = NULL;
+  GstCaps *caps;
+
+  GST_OBJECT_LOCK (sink);
+  caps = gst_pad_get_current_caps (inpad);
+  /* if the caps have gone again they keep waiting for the next ones */
+  if (caps)
+    pending = g_steal_pointer (&sink->pending_attaches);
+  g_clear_pointer (&sink->finish_attaches, g_source_unref);
+  GST_OBJECT_UNLOCK (sink);
+  gst_object_unref (inpad);
+
+  if (pending) {
+    GST_DEBUG_OBJECT (sink, "Got caps, completing %u attaches",
+        g_list_length (pending));
+    finish_pending_attaches (sink, pending, caps);
+  }
+  gst_clear_caps (&caps);
+  return G_SOURCE_REMOVE;
+}
+
+/* Called from the streaming thread when the caps arrive */
+static void
+on_caps_changed (GstPad *pad, GParamSpec *pspec, gpointer user_data)
+{
+  GstPulseVideoSink * sink = (GstPulseVideoSink*) user_data;
+  PendingAttach *attach;
+  GstCaps *caps;
+
+  GST_OBJECT_LOCK (sink);
+  caps = gst_pad_get_current_caps (pad);
+  if (caps && sink->pending_attaches && !sink->finish_attaches) {
+    attach = sink->pending_attaches->data;
+    sink->finish_attaches = g_idle_source_new ();
+    g_source_set_callback (sink->finish_attaches, on_finish_attaches,
+        gst_object_ref (sink), gst_object_unref);
+    g_source_attach (sink->finish_attaches,
+        g_source_get_context (attach->timeout));
+  }
+  GST_OBJECT_UNLOCK (sink);
+  gst_clear_caps (&caps);
+}
+
+/* Completes @attach straight away if we already have caps, otherwise when
+ * they arrive.  We own the bus name from READY so at startup clients will be
+ * waiting here while the source pipeline starts.  Either way we don't block
+ * the main loop so attaches are served in parallel.  Takes @attach. */
+static void
+gst_pulsevideo_sink_queue_attach (GstPulseVideoSink *sink,
+    PendingAttach *attach)
+{
+  GstPad *inpad = gst_element_get_static_pad (sink->fdpay, "sink");
+  GstCaps *caps;
+  gchar *caps_str;
+
+  /* the check and queueing must be atomic with respect to on_caps_changed */
+  GST_OBJECT_LOCK (sink);
+  caps = gst_pad_get_current_caps (inpad);
+  if (caps && sink->finish_attaches) {
+    /* the attaches that were waiting for these caps go first */
+    gst_clear_caps (&caps);
+  }
+  if (!caps) {
+    GST_DEBUG_OBJECT (sink, "Attach will complete later");
+    attach->timeout = g_timeout_source_new_seconds (ATTACH_CAPS_TIMEOUT);
+    g_source_set_callback (attach->timeout, on_attach_timeout, attach,
+        (GDestroyNotify) pending_attach_free);
+    g_source_attach (attach->timeout, g_main_context_get_thread_default ());
+    /* the main context keeps it alive until it is destroyed */
+    g_source_unref (attach->timeout);
+    sink->pending_attaches = g_list_prepend (sink->pending_attaches, attach);
+  }
+  GST_OBJECT_UNLOCK (sink);
+  gst_object_unref (inpad);
+
+  if (caps) {
+    caps_str = gst_caps_to_string (caps);
+    complete_attach (attach, caps_str);
+    pending_attach_free (attach);
+    g_free (caps_str);
+    gst_caps_unref (caps);
+  }
+}
+
 static gboolean
 on_handle_attach (GstVideoSource2         *interface,
                   GDBusMethodInvocation   *invocation,
                   GUnixFDList             *fdlist,
+                  GVariant                *options,
                   gpointer                user_data)
 {
   GstPulseVideoSink * sink = (GstPulseVideoSink*) user_data;
   int fds[2] = {-1, -1};
 
   GSocket* our_socket = NULL;
-  GVariant *their_socket_idx = NULL;
   GUnixFDList *their_socket_list = NULL;
   GError * gerror = NULL;
   int error = 0;
-  GstPad *inpad = NULL;
-  GstCaps *caps = NULL;
-  gchar *caps_str = NULL;
+  PendingAttach *attach;
 
   GST_DEBUG_OBJECT (sink, "Attaching client");
 
@@ -354,27 +970,20 @@ on_handle_attach (GstVideoSource2         *interface,
   }
   fds[0] = -1;
 
-  their_socket_idx = g_variant_new_handle(0);
   their_socket_list = g_unix_fd_list_new_from_array(&fds[1], 1);
   fds[1] = -1;
 
-  g_signal_emit_by_name (sink->socketsink, "add", our_socket, NULL);
-
-  inpad = gst_element_get_static_pad (sink->fdpay, "sink");
-  g_assert (inpad);
-  caps = wait_get_caps (inpad,
-      g_get_monotonic_time () + 20 * G_TIME_SPAN_SECOND, &gerror);
-  if (!caps)
-    goto out;
-  caps_str = gst_caps_to_string (caps);
-
-  static struct FaultInjectionPoint pre_attach = FAULT_INJECTION_POINT("pre_attach");
-  if (!inject_fault (&pre_attach, &gerror))
-    goto out;
+  GST_OBJECT_LOCK (sink);
+  g_hash_table_insert (sink->clients, our_socket, client_info_new (our_socket,
+      0, g_dbus_method_invocation_get_sender (invocation)));
+  GST_OBJECT_UNLOCK (sink);
+  lookup_caller_pid (sink, invocation, our_socket);
 
-  gst_video_source2_complete_attach (
-      g_steal_pointer(&interface), invocation, their_socket_list,
-      their_socket_idx, caps_str);
+  attach = pending_attach_new (sink, our_socket, options);
+  attach->interface = g_object_ref (interface);
+  attach->invocation = invocation;
+  attach->fdlist = g_steal_pointer (&their_socket_list);
+  gst_pulsevideo_sink_queue_attach (sink, attach);
 
 out:
   if (gerror) {
@@ -383,32 +992,356 @@ out:
         g_steal_pointer(&invocation), gerror);
     g_clear_error (&gerror);
   }
-  g_free (caps_str);
-  gst_clear_caps (&caps);
-  g_clear_object (&inpad);
   close (fds[0]);
   close (fds[1]);
   g_clear_object (&our_socket);
-//  if (their_socket_idx)
-//    g_variant_unref (their_socket_idx);
   g_clear_object (&their_socket_list);
   return TRUE;
 }
 
-static GstCaps *
-wait_get_caps (GstPad *pad, guint64 end_time, GError** err)
+static void
+on_client_socket_removed (GstElement *socketsink, GSocket *socket,
+    gpointer user_data)
 {
-  /* Sleeping is a bit of a hack, but should be robust in its simplicicity */
-  GstCaps *caps = NULL;
-  while ((caps = gst_pad_get_current_caps (pad)) == NULL) {
-    if (g_get_monotonic_time () > end_time) {
-      g_set_error (err, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
-          "Timeout waiting for caps");
-      break;
+  GstPulseVideoSink * sink = (GstPulseVideoSink*) user_data;
+
+  GST_OBJECT_LOCK (sink);
+  g_hash_table_remove (sink->clients, socket);
+  GST_OBJECT_UNLOCK (sink);
+}
+
+/* Copies the fields of a multisocketsink get-stats structure into an a{sv} */
+static gboolean
+add_stats_field (GQuark field_id, const GValue *value, gpointer user_data)
+{
+  GVariantBuilder *builder = user_data;
+  GVariant *v = NULL;
+
+  if (G_VALUE_HOLDS_UINT64 (value)) {
+    v = g_variant_new_uint64 (g_value_get_uint64 (value));
+  } else if (G_VALUE_HOLDS_INT (value)) {
+    v = g_variant_new_int32 (g_value_get_int (value));
+  } else if (GST_VALUE_HOLDS_ARRAY (value)) {
+    GVariantBuilder array;
+    guint i;
+
+    g_variant_builder_init (&array, G_VARIANT_TYPE ("at"));
+    for (i = 0; i < gst_value_array_get_size (value); i++) {
+      const GValue *item = gst_value_array_get_value (value, i);
+      if (G_VALUE_HOLDS_UINT64 (item))
+        g_variant_builder_add (&array, "t", g_value_get_uint64 (item));
     }
-    g_usleep (10000);
+    v = g_variant_builder_end (&array);
   }
-  return caps;
+
+  if (v)
+    g_variant_builder_add (builder, "{sv}", g_quark_to_string (field_id), v);
+  return TRUE;
+}
+
+static GVariant *
+collect_client_stats (GstPulseVideoSink *sink)
+{
+  GVariantBuilder builder;
+  GPtrArray *clients;
+  GHashTableIter iter;
+  ClientInfo *info, *copy;
+  guint i;
+
+  /* get-stats takes the clients lock, so don't hold ours while calling it */
+  clients = g_ptr_array_new_with_free_func ((GDestroyNotify) client_info_free);
+  GST_OBJECT_LOCK (sink);
+  g_hash_table_iter_init (&iter, sink->clients);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &info)) {
+    copy = client_info_new (info->socket, info->pid, info->sender);
+    copy->in_sink = info->in_sink;
+    g_ptr_array_add (clients, copy);
+  }
+  GST_OBJECT_UNLOCK (sink);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+  for (i = 0; i < clients->len; i++) {
+    GstStructure *stats = NULL;
+
+    info = g_ptr_array_index (clients, i);
+    /* Attaches still waiting for caps and idle standbys only have a pid and
+     * sender to report */
+    if (info->in_sink)
+      g_signal_emit_by_name (sink->socketsink, "get-stats", info->socket,
+          &stats);
+
+    g_variant_builder_open (&builder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add (&builder, "{sv}", "pid",
+        g_variant_new_uint32 (info->pid));
+    g_variant_builder_add (&builder, "{sv}", "sender",
+        g_variant_new_string (info->sender ? info->sender : ""));
+    if (stats) {
+      gst_structure_foreach (stats, add_stats_field, &builder);
+      gst_structure_free (stats);
+    }
+    g_variant_builder_close (&builder);
+  }
+  g_ptr_array_unref (clients);
+
+  return g_variant_builder_end (&builder);
+}
+
+static gboolean
+on_handle_get_client_stats (GstVideoSource2         *interface,
+                            GDBusMethodInvocation   *invocation,
+                            gpointer                user_data)
+{
+  GstPulseVideoSink * sink = (GstPulseVideoSink*) user_data;
+  gint64 now = g_get_monotonic_time ();
+  GVariant *stats = NULL;
+
+  GST_OBJECT_LOCK (sink);
+  if (sink->client_stats &&
+      now - sink->client_stats_time < CLIENT_STATS_MIN_INTERVAL)
+    stats = g_variant_ref (sink->client_stats);
+  GST_OBJECT_UNLOCK (sink);
+
+  if (!stats) {
+    stats = g_variant_ref_sink (collect_client_stats (sink));
+
+    GST_OBJECT_LOCK (sink);
+    if (sink->client_stats)
+      g_variant_unref (sink->client_stats);
+    sink->client_stats = g_variant_ref (stats);
+    sink->client_stats_time = now;
+    GST_OBJECT_UNLOCK (sink);
+  }
+
+  gst_video_source2_complete_get_client_stats (interface, invocation, stats);
+  g_variant_unref (stats);
+  return TRUE;
+}
+
+/* A direct client whose AttachRequest we're waiting for */
+typedef struct {
+  GstPulseVideoSink *sink;
+  GSocketConnection *connection;
+  GCredentials *credentials;
+  AttachRequest request;
+} DirectAttach;
+
+static void
+direct_attach_free (DirectAttach *direct)
+{
+  gst_object_unref (direct->sink);
+  g_object_unref (direct->connection);
+  g_object_unref (direct->credentials);
+  g_free (direct);
+}
+
+static void
+on_attach_request (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  DirectAttach *direct = user_data;
+  GstPulseVideoSink *sink = direct->sink;
+  AttachRequest *request = &direct->request;
+  GSocket *conn_socket =
+      g_socket_connection_get_socket (direct->connection);
+  GVariantBuilder options;
+  GVariant *voptions;
+  GSocket *socket = NULL;
+  PendingAttach *attach;
+  GError *err = NULL;
+  gsize len = 0;
+  gint fd;
+
+  if (!g_input_stream_read_all_finish (G_INPUT_STREAM (source), res, &len,
+          &err))
+    goto error;
+  if (len != sizeof (*request) || request->magic != ATTACH_REQUEST_MAGIC) {
+    g_set_error (&err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "Invalid AttachRequest");
+    goto error;
+  }
+
+  /* The connection closes its socket when it's destroyed so multisocketsink
+   * needs its own */
+  fd = fcntl (g_socket_get_fd (conn_socket), F_DUPFD_CLOEXEC, 0);
+  if (fd < 0) {
+    g_set_error (&err, G_IO_ERROR, g_io_error_from_errno (errno),
+        "dup failed: %s", strerror (errno));
+    goto error;
+  }
+  socket = g_socket_new_from_fd (fd, &err);
+  if (!socket) {
+    close (fd);
+    goto error;
+  }
+
+  GST_OBJECT_LOCK (sink);
+  g_hash_table_insert (sink->clients, socket, client_info_new (socket,
+      MAX (g_credentials_get_unix_pid (direct->credentials, NULL), 0), NULL));
+  GST_OBJECT_UNLOCK (sink);
+
+  g_variant_builder_init (&options, G_VARIANT_TYPE_VARDICT);
+  if (request->max_framerate > 0)
+    g_variant_builder_add (&options, "{sv}", "max-framerate",
+        g_variant_new_double (request->max_framerate));
+  if (request->flags & ATTACH_FLAG_LOW_PRIORITY)
+    g_variant_builder_add (&options, "{sv}", "priority",
+        g_variant_new_string ("low"));
+  if (request->flags & ATTACH_FLAG_CREDIT)
+    g_variant_builder_add (&options, "{sv}", "credit",
+        g_variant_new_boolean (TRUE));
+
+  voptions = g_variant_ref_sink (g_variant_builder_end (&options));
+  attach = pending_attach_new (sink, socket, voptions);
+  g_variant_unref (voptions);
+  attach->connection = g_object_ref (direct->connection);
+  gst_pulsevideo_sink_queue_attach (sink, attach);
+  goto out;
+
+error:
+  GST_WARNING_OBJECT (sink, "Direct attach failed: %s", err->message);
+out:
+  g_clear_error (&err);
+  g_clear_object (&socket);
+  direct_attach_free (direct);
+}
+
+/* A client connected to our listening socket, see AttachRequest.  The socket
+ * is in the abstract namespace so anyone can connect to it: we only serve the
+ * user we're running as, like the session bus does.  Clients send their
+ * request as soon as they connect so we read it with a short timeout in case
+ * one doesn't, without blocking the main loop while we wait. */
+static gboolean
+on_direct_attach (GSocketService *service, GSocketConnection *connection,
+    GObject *source_object, gpointer user_data)
+{
+  GstPulseVideoSink * sink = (GstPulseVideoSink*) user_data;
+  GSocket *conn_socket = g_socket_connection_get_socket (connection);
+  GInputStream *in = g_io_stream_get_input_stream (G_IO_STREAM (connection));
+  GCredentials *credentials;
+  DirectAttach *direct;
+  GError *err = NULL;
+  uid_t uid;
+
+  GST_DEBUG_OBJECT (sink, "Attaching client without DBus");
+
+  credentials = g_socket_get_credentials (conn_socket, &err);
+  if (!credentials) {
+    GST_WARNING_OBJECT (sink, "Direct attach failed: Can't get peer "
+        "credentials: %s", err->message);
+    g_clear_error (&err);
+    return TRUE;
+  }
+  uid = g_credentials_get_unix_user (credentials, NULL);
+  if (uid != getuid ()) {
+    GST_WARNING_OBJECT (sink, "Direct attach failed: Peer uid %u isn't ours",
+        (guint) uid);
+    g_object_unref (credentials);
+    return TRUE;
+  }
+
+  direct = g_new0 (DirectAttach, 1);
+  direct->sink = gst_object_ref (sink);
+  direct->connection = g_object_ref (connection);
+  direct->credentials = credentials;
+
+  /* Applies to the async read too, failing it with G_IO_ERROR_TIMED_OUT */
+  g_socket_set_timeout (conn_socket, 1);
+  g_input_stream_read_all_async (in, &direct->request,
+      sizeof (direct->request), G_PRIORITY_DEFAULT, NULL, on_attach_request,
+      direct);
+  return TRUE;
+}
+
+/* Called with the object lock held */
+static void
+gst_pulsevideo_sink_start_direct_attach (GstPulseVideoSink * sink)
+{
+  GSocketListener *listener;
+  GSocketAddress *address = NULL;
+  GSocket *listen_socket = NULL;
+  GError *error = NULL;
+  gchar *name = NULL;
+  gint fd;
+
+  if (!sink->direct_attach)
+    return;
+
+  sink->direct_service = g_socket_service_new ();
+  listener = G_SOCKET_LISTENER (sink->direct_service);
+
+  if (sink->listen_fd >= 0) {
+    /* Already bound and listening, e.g. by systemd, so clients that connected
+     * before we started are waiting in its backlog.  We dup it because the
+     * listener closes its sockets when we stop. */
+    fd = fcntl (sink->listen_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+      g_set_error (&error, G_IO_ERROR, g_io_error_from_errno (errno),
+          "dup failed: %s", strerror (errno));
+      goto error;
+    }
+    listen_socket = g_socket_new_from_fd (fd, &error);
+    if (!listen_socket) {
+      close (fd);
+      goto error;
+    }
+    if (!g_socket_listener_add_socket (listener, listen_socket, NULL, &error))
+      goto error;
+
+    address = g_socket_get_local_address (listen_socket, NULL);
+    if (G_IS_UNIX_SOCKET_ADDRESS (address) &&
+        g_unix_socket_address_get_address_type (
+            G_UNIX_SOCKET_ADDRESS (address)) ==
+        G_UNIX_SOCKET_ADDRESS_ABSTRACT) {
+      name = g_strndup (
+          g_unix_socket_address_get_path (G_UNIX_SOCKET_ADDRESS (address)),
+          g_unix_socket_address_get_path_len (
+              G_UNIX_SOCKET_ADDRESS (address)));
+    } else {
+      GST_WARNING_OBJECT (sink, "listen-fd %i isn't an abstract unix socket, "
+          "clients won't know how to reach it", sink->listen_fd);
+    }
+  } else {
+    /* Derived from the names we have on DBus so that it's the same when we're
+     * restarted and clients can reconnect to it directly */
+    name = g_strdup_printf ("pulsevideo/%s%s", sink->bus_name,
+        sink->object_path);
+    address = g_unix_socket_address_new_with_type (name, -1,
+        G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    if (!g_socket_listener_add_address (listener, address,
+            G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL,
+            &error))
+      goto error;
+  }
+
+  g_signal_connect_object (sink->direct_service, "incoming",
+      G_CALLBACK (on_direct_attach), sink, 0);
+  g_socket_service_start (sink->direct_service);
+  g_object_set (G_OBJECT (sink->dbus_interface), "direct-address",
+      name ? name : "", NULL);
+  goto out;
+
+error:
+  /* Not fatal, clients will use DBus */
+  GST_WARNING_OBJECT (sink, "Can't listen for direct attaches: %s",
+      error->message);
+  g_clear_object (&sink->direct_service);
+out:
+  g_clear_error (&error);
+  g_clear_object (&address);
+  g_clear_object (&listen_socket);
+  g_free (name);
+}
+
+/* Called with the object lock held */
+static void
+gst_pulsevideo_sink_stop_direct_attach (GstPulseVideoSink * sink)
+{
+  if (!sink->direct_service)
+    return;
+
+  g_socket_service_stop (sink->direct_service);
+  g_socket_listener_close (G_SOCKET_LISTENER (sink->direct_service));
+  g_clear_object (&sink->direct_service);
+  g_object_set (G_OBJECT (sink->dbus_interface), "direct-address", "", NULL);
 }
 
 GDBusConnection * connect_to_dbus(GDBusConnection * connection, GError ** error)
@@ -443,6 +1376,7 @@ gst_pulsevideo_sink_register_dbus (GstPulseVideoSink * sink)
         sink->object_path, error->message);
     goto out;
   }
+  gst_pulsevideo_sink_start_direct_attach (sink);
 
   sink->bus_name_token = g_bus_own_name_on_connection (sink->connection_in_use,
       sink->bus_name, 0, NULL, NULL, NULL, NULL);
@@ -458,14 +1392,25 @@ static gboolean
 gst_pulsevideo_sink_deregister_dbus (GstPulseVideoSink * bsink)
 {
   GstPulseVideoSink *sink = GST_PULSEVIDEO_SINK (bsink);
+  GList *pending;
 
   GST_OBJECT_LOCK (sink);
+  pending = g_steal_pointer (&sink->pending_attaches);
+  if (sink->finish_attaches) {
+    g_source_destroy (sink->finish_attaches);
+    g_clear_pointer (&sink->finish_attaches, g_source_unref);
+  }
   g_bus_unown_name (sink->bus_name_token);
   sink->bus_name_token = 0;
   g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (
       sink->dbus_interface));
   g_clear_object (&sink->connection_in_use);
+  gst_pulsevideo_sink_stop_direct_attach (sink);
+  /* multisocketsink will close the others when it stops */
+  g_hash_table_foreach_remove (sink->clients, is_standby_client, NULL);
   GST_OBJECT_UNLOCK (sink);
-  
+
+  finish_pending_attaches (sink, pending, NULL);
+
   return TRUE;
 }
@@ -59,6 +59,21 @@ struct _GstPulseVideoSink {
   GDBusConnection *connection_in_use;
   GstVideoSource2 *dbus_interface;
   gint bus_name_token;
+
+  /* attached clients, GSocket -> ClientInfo */
+  GHashTable *clients;
+  GVariant *client_stats;       /* cached reply to GetClientStats */
+  gint64 client_stats_time;
+
+  /* Attach calls waiting for caps, PendingAttach */
+  GList *pending_attaches;
+  /* idle source completing pending_attaches once we have caps */
+  GSource *finish_attaches;
+
+  /* for attaching without DBus, see AttachRequest */
+  gboolean direct_attach;
+  gint listen_fd;
+  GSocketService *direct_service;
 };
 
 struct _GstPulseVideoSinkClass {
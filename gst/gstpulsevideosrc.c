@@ -34,11 +34,15 @@
 #include "glib_compat.h"
 #include "gstpulsevideosrc.h"
 #include "gstvideosource2.h"
+#include <stdlib.h>
 #include <string.h>
 #include <gio/gunixfdlist.h>
+#include <gio/gunixsocketaddress.h>
 #include <gst/base/gstbasesrc.h>
 #include <gst/video/video.h>
 
+#include "tmpfile/wire-protocol.h"
+
 GST_DEBUG_CATEGORY_STATIC (pulsevideosrc_debug);
 #define GST_CAT_DEFAULT pulsevideosrc_debug
 
@@ -54,7 +58,20 @@ enum
   PROP_0,
   PROP_DBUS_CONNECTION,
   PROP_BUS_NAME,
-  PROP_OBJECT_PATH
+  PROP_OBJECT_PATH,
+  PROP_MAX_FRAMERATE,
+  PROP_LOW_PRIORITY,
+  PROP_CREDIT_WINDOW,
+  PROP_DIRECT_ATTACH,
+  PROP_DRAIN,
+  PROP_DROPPED,
+  PROP_PREFETCH,
+  PROP_WRITABLE,
+  PROP_IO_URING,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_MAILBOX,
+  PROP_STANDBY_BUS_NAME
 };
 
 typedef enum {
@@ -70,6 +87,11 @@ G_DEFINE_TYPE (GstPulseVideoSrc, gst_pulsevideo_src, GST_TYPE_BIN);
 static void gst_pulsevideo_src_finalize (GObject * gobject);
 
 static gboolean gst_pulsevideo_src_start (GstPulseVideoSrc * bsrc);
+static GstStructure *gst_pulsevideo_src_get_stats (GstPulseVideoSrc * src);
+static void gst_pulsevideo_src_start_stats (GstPulseVideoSrc * src);
+static void gst_pulsevideo_src_stop_stats (GstPulseVideoSrc * src);
+static GstPadProbeReturn on_src_probe (GstPad * pad, GstPadProbeInfo * info,
+    GstPulseVideoSrc * src);
 
 static void gst_pulsevideo_src_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
@@ -80,8 +102,13 @@ static PvInitResult gst_pulsevideo_src_reinit (
 
 static void on_socket_eos (GstElement *socketsrc, GCancellable *cancellable,
     gpointer user_data);
+static void gst_pulsevideo_src_set_mailbox (GstPulseVideoSrc * src,
+    gboolean mailbox);
 static GstStateChangeReturn gst_pulsevideo_src_change_state (
     GstElement * element, GstStateChange transition);
+static gboolean gst_pulsevideo_src_failover (GstPulseVideoSrc * src);
+static void gst_pulsevideo_src_start_standby (GstPulseVideoSrc * src);
+static void gst_pulsevideo_src_stop_standby (GstPulseVideoSrc * src);
 
 static void
 gst_pulsevideo_src_class_init (GstPulseVideoSrcClass * klass)
@@ -110,6 +137,94 @@ gst_pulsevideo_src_class_init (GstPulseVideoSrcClass * klass)
           "The DBus object path of the video source",
           "/com/stbtester/VideoSource",
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT));
+  g_object_class_install_property (gobject_class, PROP_MAX_FRAMERATE,
+      gst_param_spec_fraction ("max-framerate", "Maximum framerate",
+          "Ask the video source not to send more frames per second than this. "
+          "Frames are dropped on the server so they cost nothing. 0/1 means "
+          "all frames", 0, 1, G_MAXINT, 1, 0, 1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_LOW_PRIORITY,
+      g_param_spec_boolean ("low-priority", "Low priority",
+          "Ask to be served after the latency sensitive clients of the video "
+          "source, e.g. when recording", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CREDIT_WINDOW,
+      g_param_spec_uint ("credit-window", "Credit window",
+          "Use credit based flow control so that the video source never has "
+          "more than this many frames in flight to us.  Frames we can't take "
+          "yet are dropped on the server.  0 means no flow control", 0,
+          G_MAXUINT32, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DIRECT_ATTACH,
+      g_param_spec_boolean ("direct-attach", "Direct attach",
+          "Reconnect over the video source's listening socket if it has one "
+          "rather than through DBus", TRUE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DRAIN,
+      g_param_spec_boolean ("drain", "Drain",
+          "If we fall behind skip straight to the newest frame the video "
+          "source has sent us rather than working through the backlog",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DROPPED,
+      g_param_spec_uint64 ("dropped", "Dropped",
+          "Number of frames skipped because of \"drain\" or \"mailbox\"", 0,
+          G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PREFETCH,
+      g_param_spec_boolean ("prefetch", "Prefetch",
+          "Fault in each frame's pages in our streaming thread so the first "
+          "element downstream to read it doesn't have to", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_WRITABLE,
+      g_param_spec_boolean ("writable", "Writable",
+          "Output frames that can be modified in place.  Pages are copied "
+          "as they are written to", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_IO_URING,
+      g_param_spec_boolean ("io-uring", "io_uring",
+          "Receive frames through an io_uring shared by all the "
+          "pulsevideosrcs in the process, if it's available", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  /**
+   * GstPulseVideoSrc:stats:
+   *
+   * How old frames are when they arrive, measured from when they were
+   * captured to when we push them.  A "pulsevideosrc-stats" structure with:
+   *
+   *  - "frames": the number of frames received since we started.
+   *  - "latency-min", "latency-mean" and "latency-max": over all those frames.
+   *  - "latency-p50" and "latency-p99": over the most recent 1024 frames.
+   *  - "gaps": the number of times the interval between consecutive frames
+   *    was more than 1.5 times what the framerate (or max-framerate, if
+   *    lower) says it should be.  Frames dropped by the server, the
+   *    transport or "drain" all show up here.
+   *
+   * All latencies are in nanoseconds.
+   */
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Stats",
+          "Capture-to-arrival latency statistics", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint64 ("stats-interval", "Stats interval",
+          "Post the \"stats\" in an element message on the bus this often "
+          "(in ns) while PLAYING, whether or not frames are arriving.  0 to "
+          "disable", 0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAILBOX,
+      g_param_spec_boolean ("mailbox", "Mailbox",
+          "Receive in a thread of our own and keep only the newest frame "
+          "for downstream to take when it's ready, so a slow consumer always "
+          "gets the freshest frame and never holds up the video source.  "
+          "Can only be changed in the NULL or READY state", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_STANDBY_BUS_NAME,
+      g_param_spec_string ("standby-bus-name", "Standby bus name",
+          "The DBus bus name of a redundant video source to keep an idle "
+          "second attachment to.  If the video source we're receiving from "
+          "goes away we switch to the other one straight away rather than "
+          "reconnecting, and then attach to the first again as the standby.  "
+          "NULL for no standby", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gst_element_class_set_static_metadata (gstelement_class,
       "PulseVideo source", "Source/DBus",
@@ -130,6 +245,9 @@ on_socket_eos (GstElement *socketsrc,
   GstPulseVideoSrc *src = (GstPulseVideoSrc *) user_data;
   g_autoptr(GError) err = NULL;
 
+  if (gst_pulsevideo_src_failover (src))
+    return;
+
   GST_INFO_OBJECT (src, "VideoSource has gone away, retrying connection");
 
   switch (gst_pulsevideo_src_reinit (src, cancellable, &err)) {
@@ -147,31 +265,87 @@ on_socket_eos (GstElement *socketsrc,
   }
 }
 
+/* With the queue leaky downstream this means the oldest frame is about to be
+ * dropped */
+static void
+on_mailbox_overrun (GstElement * queue, GstPulseVideoSrc * src)
+{
+  GST_OBJECT_LOCK (src);
+  src->mailbox_dropped++;
+  GST_OBJECT_UNLOCK (src);
+}
+
+static void
+on_name_owner_changed (GDBusProxy * proxy, GParamSpec * pspec,
+    GstPulseVideoSrc * src)
+{
+  gchar *owner = g_dbus_proxy_get_name_owner (proxy);
+
+  GST_DEBUG_OBJECT (src, "%s is now owned by %s",
+      g_dbus_proxy_get_name (proxy), GST_STR_NULL (owner));
+  if (owner)
+    src->name_appeared = TRUE;
+  g_free (owner);
+}
+
+static void
+gst_pulsevideo_src_clear_videosource (GstPulseVideoSrc * src)
+{
+  if (!src->videosource)
+    return;
+  g_signal_handlers_disconnect_by_func (src->videosource,
+      G_CALLBACK (on_name_owner_changed), src);
+  g_clear_object (&src->videosource);
+}
+
 static void
 gst_pulsevideo_src_init (GstPulseVideoSrc * this)
 {
   GstPad *internal_pad, *external_pad;
-  GstElement *rawvideovalidate = NULL;
 
   this->socketsrc = gst_element_factory_make ("pvsocketsrc", NULL);
   gst_base_src_set_live (GST_BASE_SRC (this->socketsrc), TRUE);
   gst_base_src_set_format (GST_BASE_SRC (this->socketsrc), GST_FORMAT_TIME);
+  /* Every message is an FDMessage.  The default blocksize of 4096 would cost
+   * us a page-sized allocation per frame that we only use 24 bytes of. */
+  gst_base_src_set_blocksize (GST_BASE_SRC (this->socketsrc),
+      sizeof (FDMessage));
   gst_bin_add (GST_BIN (this), gst_object_ref (this->socketsrc));
+  this->max_framerate_n = 0;
+  this->max_framerate_d = 1;
+  this->direct_attach = TRUE;
+  this->latency_min = GST_CLOCK_TIME_NONE;
+  this->last_pts = GST_CLOCK_TIME_NONE;
+  this->dbus_context = g_main_context_new ();
+  this->standby_cancellable = g_cancellable_new ();
   this->fddepay = gst_element_factory_make ("pvfddepay", NULL);
   gst_bin_add (GST_BIN (this), gst_object_ref (this->fddepay));
   this->capsfilter = gst_element_factory_make ("capsfilter", NULL);
   gst_bin_add (GST_BIN (this), gst_object_ref (this->capsfilter));
-  rawvideovalidate = gst_element_factory_make ("rawvideovalidate", NULL);
-  gst_bin_add (GST_BIN (this), rawvideovalidate);
+  this->rawvideovalidate = gst_element_factory_make ("rawvideovalidate", NULL);
+  gst_bin_add (GST_BIN (this), gst_object_ref (this->rawvideovalidate));
   gst_element_link_many (
-        this->socketsrc, this->fddepay, this->capsfilter, rawvideovalidate,
-        NULL);
+        this->socketsrc, this->fddepay, this->capsfilter,
+        this->rawvideovalidate, NULL);
 
-  internal_pad = gst_element_get_static_pad (rawvideovalidate, "src");
+  internal_pad = gst_element_get_static_pad (this->rawvideovalidate, "src");
   external_pad = gst_ghost_pad_new ("src", internal_pad);
   gst_element_add_pad (GST_ELEMENT (this), external_pad);
+  /* On the ghost pad so that in mailbox mode we measure when downstream
+   * takes the frame */
+  gst_pad_add_probe (external_pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      (GstPadProbeCallback) on_src_probe, this, NULL);
   gst_object_unref (internal_pad);
 
+  this->mailbox = gst_element_factory_make ("queue", NULL);
+  g_object_set (this->mailbox, "max-size-buffers", 1, "max-size-bytes", 0,
+      "max-size-time", (guint64) 0, NULL);
+  gst_util_set_object_arg (G_OBJECT (this->mailbox), "leaky", "downstream");
+  gst_object_ref_sink (this->mailbox);
+  g_signal_connect (this->mailbox, "overrun", G_CALLBACK (on_mailbox_overrun),
+      this);
+
   g_signal_connect (this->socketsrc, "on-socket-eos",
       G_CALLBACK (on_socket_eos), this);
 }
@@ -187,10 +361,20 @@ gst_pulsevideo_src_finalize (GObject * gobject)
   g_free (this->bus_name);
   this->bus_name = NULL;
   g_free (this->object_path);
+  g_free (this->direct_address);
+  gst_pulsevideo_src_clear_videosource (this);
+  g_main_context_unref (this->dbus_context);
+  gst_pulsevideo_src_stop_standby (this);
+  g_free (this->standby_bus_name);
+  g_clear_object (&this->standby_cancellable);
   g_clear_object (&this->dbus);
   g_clear_object (&this->socketsrc);
   g_clear_object (&this->fddepay);
   g_clear_object (&this->capsfilter);
+  g_clear_object (&this->rawvideovalidate);
+  g_signal_handlers_disconnect_by_func (this->mailbox,
+      G_CALLBACK (on_mailbox_overrun), gobject);
+  g_clear_object (&this->mailbox);
 
   G_OBJECT_CLASS (parent_class)->finalize (gobject);
 }
@@ -232,6 +416,59 @@ gst_pulsevideo_src_set_property (GObject * object, guint prop_id,
       g_free (object_path);
       break;
     }
+    case PROP_MAX_FRAMERATE:
+      GST_OBJECT_LOCK (src);
+      src->max_framerate_n = gst_value_get_fraction_numerator (value);
+      src->max_framerate_d = gst_value_get_fraction_denominator (value);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_LOW_PRIORITY:
+      GST_OBJECT_LOCK (src);
+      src->low_priority = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_CREDIT_WINDOW:
+      GST_OBJECT_LOCK (src);
+      src->credit_window = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_DIRECT_ATTACH:
+      GST_OBJECT_LOCK (src);
+      src->direct_attach = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_DRAIN:
+      g_object_set_property (G_OBJECT (src->socketsrc), "drain", value);
+      break;
+    case PROP_PREFETCH:
+      g_object_set_property (G_OBJECT (src->fddepay), "prefetch", value);
+      break;
+    case PROP_WRITABLE:
+      g_object_set_property (G_OBJECT (src->fddepay), "writable", value);
+      break;
+    case PROP_IO_URING:
+      g_object_set_property (G_OBJECT (src->socketsrc), "io-uring", value);
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (src);
+      src->stats_interval = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (src);
+      if (GST_STATE (src) == GST_STATE_PLAYING) {
+        gst_pulsevideo_src_stop_stats (src);
+        gst_pulsevideo_src_start_stats (src);
+      }
+      break;
+    case PROP_MAILBOX:
+      gst_pulsevideo_src_set_mailbox (src, g_value_get_boolean (value));
+      break;
+    case PROP_STANDBY_BUS_NAME: {
+      gchar *standby_bus_name = g_value_dup_string (value);
+      GST_OBJECT_LOCK (src);
+      SWAP (standby_bus_name, src->standby_bus_name);
+      GST_OBJECT_UNLOCK (src);
+      g_free (standby_bus_name);
+      break;
+    }
 
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -262,12 +499,307 @@ gst_pulsevideo_src_get_property (GObject * object, guint prop_id,
       GST_OBJECT_UNLOCK (pulsevideosrc);
       break;
     }
+    case PROP_MAX_FRAMERATE:
+      GST_OBJECT_LOCK (pulsevideosrc);
+      gst_value_set_fraction (value, pulsevideosrc->max_framerate_n,
+          pulsevideosrc->max_framerate_d);
+      GST_OBJECT_UNLOCK (pulsevideosrc);
+      break;
+    case PROP_LOW_PRIORITY:
+      GST_OBJECT_LOCK (pulsevideosrc);
+      g_value_set_boolean (value, pulsevideosrc->low_priority);
+      GST_OBJECT_UNLOCK (pulsevideosrc);
+      break;
+    case PROP_CREDIT_WINDOW:
+      GST_OBJECT_LOCK (pulsevideosrc);
+      g_value_set_uint (value, pulsevideosrc->credit_window);
+      GST_OBJECT_UNLOCK (pulsevideosrc);
+      break;
+    case PROP_DIRECT_ATTACH:
+      GST_OBJECT_LOCK (pulsevideosrc);
+      g_value_set_boolean (value, pulsevideosrc->direct_attach);
+      GST_OBJECT_UNLOCK (pulsevideosrc);
+      break;
+    case PROP_DRAIN:
+      g_object_get_property (G_OBJECT (pulsevideosrc->socketsrc), "drain",
+          value);
+      break;
+    case PROP_DROPPED:{
+      guint64 dropped = 0;
+
+      g_object_get (pulsevideosrc->socketsrc, "dropped", &dropped, NULL);
+      GST_OBJECT_LOCK (pulsevideosrc);
+      dropped += pulsevideosrc->mailbox_dropped;
+      GST_OBJECT_UNLOCK (pulsevideosrc);
+      g_value_set_uint64 (value, dropped);
+      break;
+    }
+    case PROP_PREFETCH:
+      g_object_get_property (G_OBJECT (pulsevideosrc->fddepay), "prefetch",
+          value);
+      break;
+    case PROP_WRITABLE:
+      g_object_get_property (G_OBJECT (pulsevideosrc->fddepay), "writable",
+          value);
+      break;
+    case PROP_IO_URING:
+      g_object_get_property (G_OBJECT (pulsevideosrc->socketsrc), "io-uring",
+          value);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_pulsevideo_src_get_stats (pulsevideosrc));
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (pulsevideosrc);
+      g_value_set_uint64 (value, pulsevideosrc->stats_interval);
+      GST_OBJECT_UNLOCK (pulsevideosrc);
+      break;
+    case PROP_MAILBOX:
+      GST_OBJECT_LOCK (pulsevideosrc);
+      g_value_set_boolean (value,
+          GST_OBJECT_PARENT (pulsevideosrc->mailbox) != NULL);
+      GST_OBJECT_UNLOCK (pulsevideosrc);
+      break;
+    case PROP_STANDBY_BUS_NAME:
+      GST_OBJECT_LOCK (pulsevideosrc);
+      g_value_set_string (value, pulsevideosrc->standby_bus_name);
+      GST_OBJECT_UNLOCK (pulsevideosrc);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
+/* Puts the mailbox between rawvideovalidate and our src pad or takes it out
+ * again.  Changing the threading like this isn't safe while we're running. */
+static void
+gst_pulsevideo_src_set_mailbox (GstPulseVideoSrc * src, gboolean mailbox)
+{
+  GstPad *ghost, *target;
+  gboolean running, have_mailbox;
+
+  GST_OBJECT_LOCK (src);
+  running = GST_STATE (src) > GST_STATE_READY;
+  have_mailbox = GST_OBJECT_PARENT (src->mailbox) != NULL;
+  GST_OBJECT_UNLOCK (src);
+
+  if (mailbox == have_mailbox)
+    return;
+  if (running) {
+    GST_WARNING_OBJECT (src, "Can't change \"mailbox\" while running");
+    return;
+  }
+
+  ghost = gst_element_get_static_pad (GST_ELEMENT (src), "src");
+  gst_ghost_pad_set_target (GST_GHOST_PAD (ghost), NULL);
+  if (mailbox) {
+    gst_bin_add (GST_BIN (src), src->mailbox);
+    gst_element_link (src->rawvideovalidate, src->mailbox);
+    target = gst_element_get_static_pad (src->mailbox, "src");
+  } else {
+    gst_element_unlink (src->rawvideovalidate, src->mailbox);
+    gst_bin_remove (GST_BIN (src), src->mailbox);
+    gst_element_set_state (src->mailbox, GST_STATE_NULL);
+    target = gst_element_get_static_pad (src->rawvideovalidate, "src");
+  }
+  gst_ghost_pad_set_target (GST_GHOST_PAD (ghost), target);
+  gst_object_unref (target);
+  gst_object_unref (ghost);
+}
+
+static void
+gst_pulsevideo_src_reset_stats (GstPulseVideoSrc * src)
+{
+  GST_OBJECT_LOCK (src);
+  src->frames = 0;
+  src->latency_min = GST_CLOCK_TIME_NONE;
+  src->latency_max = 0;
+  src->latency_sum = 0;
+  src->gaps = 0;
+  src->last_pts = GST_CLOCK_TIME_NONE;
+  GST_OBJECT_UNLOCK (src);
+}
+
+static gint
+compare_clock_time (gconstpointer a, gconstpointer b)
+{
+  GstClockTime x = *(const GstClockTime *) a, y = *(const GstClockTime *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static GstStructure *
+gst_pulsevideo_src_get_stats (GstPulseVideoSrc * src)
+{
+  GstClockTime window[GST_PULSEVIDEO_SRC_LATENCY_WINDOW];
+  GstClockTime min, max, mean = 0, p50 = 0, p99 = 0;
+  guint64 frames, gaps;
+  guint n;
+
+  GST_OBJECT_LOCK (src);
+  frames = src->frames;
+  gaps = src->gaps;
+  min = frames > 0 ? src->latency_min : 0;
+  max = src->latency_max;
+  if (frames > 0)
+    mean = src->latency_sum / frames;
+  n = MIN (frames, GST_PULSEVIDEO_SRC_LATENCY_WINDOW);
+  memcpy (window, src->latency_window, n * sizeof (GstClockTime));
+  GST_OBJECT_UNLOCK (src);
+
+  if (n > 0) {
+    qsort (window, n, sizeof (GstClockTime), compare_clock_time);
+    p50 = window[n * 50 / 100];
+    p99 = window[n * 99 / 100];
+  }
+
+  return gst_structure_new ("pulsevideosrc-stats",
+      "frames", G_TYPE_UINT64, frames,
+      "latency-min", G_TYPE_UINT64, min,
+      "latency-mean", G_TYPE_UINT64, mean,
+      "latency-p50", G_TYPE_UINT64, p50,
+      "latency-p99", G_TYPE_UINT64, p99,
+      "latency-max", G_TYPE_UINT64, max,
+      "gaps", G_TYPE_UINT64, gaps, NULL);
+}
+
+/* PTS is the capture time in running time, so how long ago that was is the
+ * latency of @buf */
+static void
+gst_pulsevideo_src_record_latency (GstPulseVideoSrc * src, GstBuffer * buf)
+{
+  GstClockTime pts = GST_BUFFER_PTS (buf), now, latency, frame_duration;
+  GstClock *clock;
+
+  clock = gst_element_get_clock (GST_ELEMENT (src));
+  if (clock == NULL || !GST_CLOCK_TIME_IS_VALID (pts)) {
+    g_clear_object (&clock);
+    return;
+  }
+  now = gst_clock_get_time (clock) -
+      gst_element_get_base_time (GST_ELEMENT (src));
+  gst_object_unref (clock);
+  latency = now > pts ? now - pts : 0;
+
+  GST_OBJECT_LOCK (src);
+  frame_duration = src->frame_duration;
+  if (src->max_framerate_n > 0)
+    frame_duration = MAX (frame_duration, gst_util_uint64_scale_int (
+            GST_SECOND, src->max_framerate_d, src->max_framerate_n));
+  if (frame_duration > 0 && GST_CLOCK_TIME_IS_VALID (src->last_pts) &&
+      pts > src->last_pts + frame_duration * 3 / 2)
+    src->gaps++;
+  src->last_pts = pts;
+
+  src->latency_window[src->frames % GST_PULSEVIDEO_SRC_LATENCY_WINDOW] =
+      latency;
+  src->frames++;
+  src->latency_sum += latency;
+  src->latency_max = MAX (src->latency_max, latency);
+  if (!GST_CLOCK_TIME_IS_VALID (src->latency_min) || latency < src->latency_min)
+    src->latency_min = latency;
+  GST_OBJECT_UNLOCK (src);
+}
+
+/* Called from the clock's thread */
+static gboolean
+on_stats_timeout (GstClock * clock, GstClockTime time, GstClockID id,
+    gpointer user_data)
+{
+  GstPulseVideoSrc *src = user_data;
+
+  gst_element_post_message (GST_ELEMENT (src),
+      gst_message_new_element (GST_OBJECT (src),
+          gst_pulsevideo_src_get_stats (src)));
+  return TRUE;
+}
+
+/* The stats are posted from a periodic clock callback rather than as frames
+ * arrive, so that a stream that has stopped still reports */
+static void
+gst_pulsevideo_src_start_stats (GstPulseVideoSrc * src)
+{
+  GstClockTime interval;
+  GstClock *clock;
+  GstClockID id;
+
+  GST_OBJECT_LOCK (src);
+  interval = src->stats_interval;
+  clock = GST_ELEMENT_CLOCK (src) ? gst_object_ref (GST_ELEMENT_CLOCK (src)) :
+      NULL;
+  GST_OBJECT_UNLOCK (src);
+
+  if (interval > 0 && clock) {
+    id = gst_clock_new_periodic_id (clock,
+        gst_clock_get_time (clock) + interval, interval);
+    gst_clock_id_wait_async (id, on_stats_timeout, gst_object_ref (src),
+        gst_object_unref);
+    GST_OBJECT_LOCK (src);
+    src->stats_clock_id = id;
+    GST_OBJECT_UNLOCK (src);
+  }
+  g_clear_object (&clock);
+}
+
+static void
+gst_pulsevideo_src_stop_stats (GstPulseVideoSrc * src)
+{
+  GstClockID id;
+
+  GST_OBJECT_LOCK (src);
+  id = g_steal_pointer (&src->stats_clock_id);
+  GST_OBJECT_UNLOCK (src);
+
+  if (id) {
+    gst_clock_id_unschedule (id);
+    gst_clock_id_unref (id);
+  }
+}
+
+static GstPadProbeReturn
+on_src_probe (GstPad * pad, GstPadProbeInfo * info, GstPulseVideoSrc * src)
+{
+  GstEvent *event;
+  GstBuffer *buf;
+  GstCaps *caps;
+  gint fps_n = 0, fps_d = 1;
+  gboolean stale = FALSE;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    buf = GST_PAD_PROBE_INFO_BUFFER (info);
+    /* The standby may have queued frames for us that were captured before
+     * the last one we got from the video source that went away */
+    GST_OBJECT_LOCK (src);
+    if (src->failed_over && GST_BUFFER_PTS_IS_VALID (buf) &&
+        GST_CLOCK_TIME_IS_VALID (src->last_pts) &&
+        GST_BUFFER_PTS (buf) <= src->last_pts)
+      stale = TRUE;
+    else
+      src->failed_over = FALSE;
+    GST_OBJECT_UNLOCK (src);
+    if (stale) {
+      GST_DEBUG_OBJECT (src, "Dropping frame from before the failover, PTS %"
+          GST_TIME_FORMAT, GST_TIME_ARGS (GST_BUFFER_PTS (buf)));
+      return GST_PAD_PROBE_DROP;
+    }
+    gst_pulsevideo_src_record_latency (src, buf);
+    return GST_PAD_PROBE_OK;
+  }
+
+  event = GST_PAD_PROBE_INFO_EVENT (info);
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+    gst_event_parse_caps (event, &caps);
+    gst_structure_get_fraction (gst_caps_get_structure (caps, 0),
+        "framerate", &fps_n, &fps_d);
+    GST_OBJECT_LOCK (src);
+    src->frame_duration = fps_n > 0 ?
+        gst_util_uint64_scale_int (GST_SECOND, fps_d, fps_n) : 0;
+    GST_OBJECT_UNLOCK (src);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
 static GstStateChangeReturn
 gst_pulsevideo_src_change_state (GstElement * element,
     GstStateChange transition)
@@ -277,7 +809,11 @@ gst_pulsevideo_src_change_state (GstElement * element,
 
   src = GST_PULSEVIDEO_SRC (element);
 
+  if (transition == GST_STATE_CHANGE_PLAYING_TO_PAUSED)
+    gst_pulsevideo_src_stop_stats (src);
+
   if (transition == GST_STATE_CHANGE_READY_TO_PAUSED) {
+    gst_pulsevideo_src_reset_stats (src);
     if (!gst_pulsevideo_src_start ((GstPulseVideoSrc*) element)) {
       result = GST_STATE_CHANGE_FAILURE;
       goto failure;
@@ -289,8 +825,14 @@ gst_pulsevideo_src_change_state (GstElement * element,
   if (result == GST_STATE_CHANGE_FAILURE)
     GST_DEBUG_OBJECT (src, "parent failed state change");
 
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_PLAYING &&
+      result != GST_STATE_CHANGE_FAILURE)
+    gst_pulsevideo_src_start_stats (src);
+
   if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
     g_object_set (src->socketsrc, "socket", NULL, NULL);
+    gst_pulsevideo_src_clear_videosource (src);
+    gst_pulsevideo_src_stop_standby (src);
   }
 
   return result;
@@ -321,6 +863,215 @@ is_dbus_error_recoverable(GError * err)
     g_error_matches (err, G_DBUS_ERROR, G_DBUS_ERROR_TIMED_OUT);
 }
 
+/* Retries back off exponentially from RETRY_DELAY_MIN up to RETRY_DELAY_MAX
+ * microseconds.  The delay is randomised so that when a restarted server is
+ * reattached to by all of its clients at once they are spread out rather than
+ * retrying in lockstep. */
+#define RETRY_DELAY_MIN (10 * G_TIME_SPAN_MILLISECOND)
+#define RETRY_DELAY_MAX G_TIME_SPAN_SECOND
+
+static gint64
+retry_delay (guint attempt)
+{
+  gint64 delay = RETRY_DELAY_MAX;
+
+  if (attempt < 7)
+    delay = MIN (RETRY_DELAY_MIN << attempt, RETRY_DELAY_MAX);
+  return g_random_int_range (delay / 2, delay + 1);
+}
+
+static gboolean
+on_retry_timeout (gpointer user_data)
+{
+  *(gboolean *) user_data = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_retry_cancelled (GCancellable * cancellable, gpointer user_data)
+{
+  *(gboolean *) user_data = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+/* Waits in @context before retry number @attempt, or until @wake (if not
+ * %NULL) is set by something dispatched in @context.  Returns FALSE if
+ * @cancellable was cancelled while waiting. */
+static gboolean
+wait_for_retry (GMainContext * context, GCancellable * cancellable,
+    guint attempt, const gboolean * wake)
+{
+  GSource *timeout, *cancelled = NULL;
+  gboolean done = FALSE;
+
+  timeout = g_timeout_source_new (
+      retry_delay (attempt) / G_TIME_SPAN_MILLISECOND);
+  g_source_set_callback (timeout, on_retry_timeout, &done, NULL);
+  g_source_attach (timeout, context);
+  if (cancellable) {
+    cancelled = g_cancellable_source_new (cancellable);
+    g_source_set_callback (cancelled, (GSourceFunc) on_retry_cancelled, &done,
+        NULL);
+    g_source_attach (cancelled, context);
+  }
+
+  g_main_context_push_thread_default (context);
+  while (!done && !(wake && *wake))
+    g_main_context_iteration (context, TRUE);
+  g_main_context_pop_thread_default (context);
+
+  g_source_destroy (timeout);
+  g_source_unref (timeout);
+  if (cancelled) {
+    g_source_destroy (cancelled);
+    g_source_unref (cancelled);
+  }
+  return !g_cancellable_is_cancelled (cancellable);
+}
+
+/* The options we pass to VideoSource2.Attach */
+static GVariant *
+attach_options (gdouble max_framerate, gboolean low_priority, gboolean credit,
+    gboolean standby)
+{
+  GVariantBuilder options;
+
+  g_variant_builder_init (&options, G_VARIANT_TYPE_VARDICT);
+  if (max_framerate > 0)
+    g_variant_builder_add (&options, "{sv}", "max-framerate",
+        g_variant_new_double (max_framerate));
+  if (low_priority)
+    g_variant_builder_add (&options, "{sv}", "priority",
+        g_variant_new_string ("low"));
+  if (credit)
+    g_variant_builder_add (&options, "{sv}", "credit",
+        g_variant_new_boolean (TRUE));
+  if (standby)
+    g_variant_builder_add (&options, "{sv}", "standby",
+        g_variant_new_boolean (TRUE));
+  return g_variant_builder_end (&options);
+}
+
+/* Calls VideoSource2.Attach on @bus_name.  Not through a GstVideoSource2
+ * proxy: until that has heard that an old server is gone it would send the
+ * call to the old server's unique name. */
+static gboolean
+call_attach (GDBusConnection * dbus, const gchar * bus_name,
+    const gchar * object_path, GVariant * options, gchar ** scaps,
+    GUnixFDList ** fdlist, GCancellable * cancellable, GError ** error)
+{
+  GVariant *reply;
+  gint32 handle;
+
+  reply = g_dbus_connection_call_with_unix_fd_list_sync (dbus, bus_name,
+      object_path, "com.stbtester.VideoSource2", "Attach",
+      g_variant_new ("(@a{sv})", options), G_VARIANT_TYPE ("(hs)"),
+      G_DBUS_CALL_FLAGS_NONE, -1, NULL, fdlist, cancellable, error);
+  if (!reply)
+    return FALSE;
+  g_variant_get (reply, "(hs)", &handle, scaps);
+  g_variant_unref (reply);
+  return TRUE;
+}
+
+static gboolean
+socket_receive_all (GSocket * socket, gpointer buf, gsize len,
+    GCancellable * cancellable, GError ** error)
+{
+  gssize n;
+
+  while (len > 0) {
+    n = g_socket_receive (socket, buf, len, cancellable, error);
+    if (n < 0)
+      return FALSE;
+    if (n == 0) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED,
+          "Connection closed");
+      return FALSE;
+    }
+    buf = (gchar *) buf + n;
+    len -= n;
+  }
+  return TRUE;
+}
+
+/* Slightly longer than pulsevideosink waits for caps before failing an
+ * attach */
+#define DIRECT_ATTACH_TIMEOUT 25
+
+/* Attach using the handshake on the video source's listening socket rather
+ * than with DBus, see AttachRequest.  Returns the socket frames will arrive on
+ * and sets @scaps, or returns NULL if we should use DBus instead. */
+static GSocket *
+direct_attach (GstPulseVideoSrc * src, const gchar * address,
+    gdouble max_framerate, gboolean low_priority, gboolean credit,
+    gchar ** scaps, GCancellable * cancellable)
+{
+  AttachRequest request = { ATTACH_REQUEST_MAGIC, 0, max_framerate };
+  AttachReply reply;
+  GSocketAddress *addr = NULL;
+  GSocket *socket = NULL;
+  gchar *caps = NULL;
+  GError *err = NULL;
+  gssize n;
+
+  if (low_priority)
+    request.flags |= ATTACH_FLAG_LOW_PRIORITY;
+  if (credit)
+    request.flags |= ATTACH_FLAG_CREDIT;
+
+  socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM,
+      G_SOCKET_PROTOCOL_DEFAULT, &err);
+  if (!socket)
+    goto error;
+  /* The video source may keep us waiting for its first frame */
+  g_socket_set_timeout (socket, DIRECT_ATTACH_TIMEOUT);
+
+  addr = g_unix_socket_address_new_with_type (address, -1,
+      G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+  if (!g_socket_connect (socket, addr, cancellable, &err))
+    goto error;
+
+  n = g_socket_send (socket, (const gchar *) &request, sizeof (request),
+      cancellable, &err);
+  if (n < 0)
+    goto error;
+  if (n != sizeof (request)) {
+    g_set_error (&err, G_IO_ERROR, G_IO_ERROR_FAILED, "Short write");
+    goto error;
+  }
+
+  if (!socket_receive_all (socket, &reply, sizeof (reply), cancellable, &err))
+    goto error;
+  if (reply.magic != ATTACH_REPLY_MAGIC || reply.caps_len > 65536) {
+    g_set_error (&err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "Invalid AttachReply");
+    goto error;
+  }
+  if (reply.caps_len == 0) {
+    g_set_error (&err, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED,
+        "Video source doesn't have caps yet");
+    goto error;
+  }
+  caps = g_malloc0 (reply.caps_len + 1);
+  if (!socket_receive_all (socket, caps, reply.caps_len, cancellable, &err))
+    goto error;
+
+  g_socket_set_timeout (socket, 0);
+  *scaps = g_steal_pointer (&caps);
+  goto out;
+
+error:
+  GST_DEBUG_OBJECT (src, "Direct attach on %s failed, using DBus: %s",
+      address, err->message);
+  g_clear_object (&socket);
+out:
+  g_clear_error (&err);
+  g_clear_object (&addr);
+  g_free (caps);
+  return socket;
+}
+
 static PvInitResult
 gst_pulsevideo_src_reinit (GstPulseVideoSrc * src, GCancellable* cancellable,
     GError **error)
@@ -328,6 +1079,10 @@ gst_pulsevideo_src_reinit (GstPulseVideoSrc * src, GCancellable* cancellable,
   GDBusConnection *dbus = NULL;
   gchar *bus_name = NULL;
   gchar *object_path = NULL;
+  gchar *direct_address = NULL;
+  gdouble max_framerate = 0;
+  gboolean low_priority, waited;
+  guint credit_window;
   GError *err = NULL;
 
   gboolean ret = PV_INIT_FAILURE;
@@ -336,12 +1091,20 @@ gst_pulsevideo_src_reinit (GstPulseVideoSrc * src, GCancellable* cancellable,
   GUnixFDList *fdlist = NULL;
   gint *fds = NULL;
   GSocket *socket = NULL;
+  guint attempt = 0;
 
   GST_OBJECT_LOCK (src);
   if (src->dbus)
     dbus = g_object_ref (src->dbus);
   bus_name = g_strdup (src->bus_name);
   object_path = g_strdup (src->object_path);
+  if (src->max_framerate_n > 0)
+    gst_util_fraction_to_double (src->max_framerate_n, src->max_framerate_d,
+        &max_framerate);
+  low_priority = src->low_priority;
+  credit_window = src->credit_window;
+  if (src->direct_attach)
+    direct_address = g_strdup (src->direct_address);
   GST_OBJECT_UNLOCK (src);
 
   if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
@@ -349,6 +1112,15 @@ gst_pulsevideo_src_reinit (GstPulseVideoSrc * src, GCancellable* cancellable,
     goto done;
   }
 
+  if (direct_address && direct_address[0] != '\0') {
+    socket = direct_attach (src, direct_address, max_framerate, low_priority,
+        credit_window > 0, &scaps, cancellable);
+    if (socket) {
+      GST_INFO_OBJECT (src, "Attached directly on %s", direct_address);
+      goto attached;
+    }
+  }
+
   if (!dbus) {
     dbus = g_bus_get_sync (G_BUS_TYPE_SESSION, cancellable, &err);
     if (!dbus) {
@@ -363,22 +1135,42 @@ gst_pulsevideo_src_reinit (GstPulseVideoSrc * src, GCancellable* cancellable,
       g_autofree gchar* msg = g_dbus_error_get_remote_error (err);
       GST_WARNING_OBJECT (src, "Attach failed with error %s.  Retrying", msg);
       g_clear_error (&err);
+      /* A restarted server can be attached to as soon as it has claimed
+       * its name, so don't wait any longer than that */
+      waited = wait_for_retry (src->dbus_context, cancellable, attempt++,
+          &src->name_appeared);
+      if (src->name_appeared)
+        GST_DEBUG_OBJECT (src, "Bus name has a new owner, retrying now");
+      src->name_appeared = FALSE;
+      if (!waited) {
+        g_cancellable_set_error_if_cancelled (cancellable, &err);
+        ret = PV_INIT_NOOBJECT;
+        goto done;
+      }
     }
 
-    g_autoptr(GstVideoSource2) videosource = NULL;
-    videosource = gst_video_source2_proxy_new_sync (dbus,
-        G_DBUS_PROXY_FLAGS_NONE, bus_name, object_path, cancellable, &err);
-    if (!videosource) {
-      if (is_dbus_error_recoverable (err))
-        /* Retry */
-        continue;
-      GST_ELEMENT_ERROR (src, RESOURCE, NOT_FOUND, (NULL),
-          ("Could not create VideoSource DBus proxy: %s", err->message));
-      goto done;
+    if (!src->videosource) {
+      /* So that its signals are dispatched only when we're waiting to
+       * retry */
+      g_main_context_push_thread_default (src->dbus_context);
+      src->videosource = G_DBUS_PROXY (gst_video_source2_proxy_new_sync (dbus,
+          G_DBUS_PROXY_FLAGS_NONE, bus_name, object_path, cancellable, &err));
+      g_main_context_pop_thread_default (src->dbus_context);
+      if (!src->videosource) {
+        if (is_dbus_error_recoverable (err))
+          /* Retry */
+          continue;
+        GST_ELEMENT_ERROR (src, RESOURCE, NOT_FOUND, (NULL),
+            ("Could not create VideoSource DBus proxy: %s", err->message));
+        goto done;
+      }
+      g_signal_connect (src->videosource, "notify::g-name-owner",
+          G_CALLBACK (on_name_owner_changed), src);
     }
 
-    if (!gst_video_source2_call_attach_sync (videosource, NULL, NULL, &scaps,
-            &fdlist, cancellable, &err)) {
+    if (!call_attach (dbus, bus_name, object_path,
+            attach_options (max_framerate, low_priority, credit_window > 0,
+                FALSE), &scaps, &fdlist, cancellable, &err)) {
       if (is_dbus_error_recoverable (err))
         /* Retry */
         continue;
@@ -390,16 +1182,24 @@ gst_pulsevideo_src_reinit (GstPulseVideoSrc * src, GCancellable* cancellable,
       goto done;
     }
 
+    /* So that we can reconnect without DBus next time.  After a restart the
+     * proxy reloads its properties asynchronously on dbus_context, so give
+     * it the chance to finish that first.  If it hasn't we keep the address
+     * we had, it stays the same across restarts. */
+    while (g_main_context_iteration (src->dbus_context, FALSE));
+    src->name_appeared = FALSE;
+    g_free (direct_address);
+    direct_address = gst_video_source2_dup_direct_address (
+        GST_VIDEO_SOURCE2 (src->videosource));
+    if (direct_address) {
+      GST_OBJECT_LOCK (src);
+      g_free (src->direct_address);
+      src->direct_address = g_strdup (direct_address);
+      GST_OBJECT_UNLOCK (src);
+    }
     break;
   }
 
-  g_assert (scaps);
-  caps = gst_caps_from_string (g_steal_pointer (&scaps));
-  g_object_set (src->capsfilter, "caps", caps, NULL);
-
-  GST_INFO_OBJECT (src, "Received remote caps %" GST_PTR_FORMAT, caps);
-  gst_caps_unref (g_steal_pointer (&caps));
-
   fds = g_unix_fd_list_steal_fds (fdlist, NULL);
   socket = g_socket_new_from_fd (fds[0], &err);
   if (!socket) {
@@ -408,7 +1208,20 @@ gst_pulsevideo_src_reinit (GstPulseVideoSrc * src, GCancellable* cancellable,
     goto done;
   }
 
-  g_object_set (src->socketsrc, "socket", socket, "do-timestamp", TRUE, NULL);
+attached:
+  g_assert (scaps);
+  caps = gst_caps_from_string (g_steal_pointer (&scaps));
+  g_object_set (src->capsfilter, "caps", caps, NULL);
+
+  GST_INFO_OBJECT (src, "Received remote caps %" GST_PTR_FORMAT, caps);
+  gst_caps_unref (g_steal_pointer (&caps));
+
+  g_object_set (src->socketsrc, "socket", socket, "do-timestamp", TRUE,
+      "credit-window", credit_window, NULL);
+  GST_OBJECT_LOCK (src);
+  src->on_standby = FALSE;
+  GST_OBJECT_UNLOCK (src);
+  gst_pulsevideo_src_start_standby (src);
 
   ret = PV_INIT_SUCCESS;
 
@@ -419,6 +1232,7 @@ done:
 
   g_free (bus_name);
   g_free (object_path);
+  g_free (direct_address);
   g_free (fds);
 
   if (err)
@@ -427,6 +1241,193 @@ done:
   return ret;
 }
 
+static gpointer
+gst_pulsevideo_src_standby_thread (gpointer user_data)
+{
+  GstPulseVideoSrc *src = GST_PULSEVIDEO_SRC (user_data);
+  GDBusConnection *dbus = NULL;
+  GMainContext *context = g_main_context_new ();
+  GCancellable *cancellable;
+  gchar *bus_name, *object_path, *scaps = NULL;
+  gdouble max_framerate = 0;
+  gboolean low_priority, credit, to_primary;
+  GUnixFDList *fdlist = NULL;
+  GSocket *socket = NULL;
+  gint *fds = NULL;
+  GError *err = NULL;
+  guint attempt = 0;
+
+  GST_OBJECT_LOCK (src);
+  if (src->dbus)
+    dbus = g_object_ref (src->dbus);
+  to_primary = src->standby_target_primary;
+  bus_name = g_strdup (to_primary ? src->bus_name : src->standby_bus_name);
+  object_path = g_strdup (src->object_path);
+  if (src->max_framerate_n > 0)
+    gst_util_fraction_to_double (src->max_framerate_n, src->max_framerate_d,
+        &max_framerate);
+  low_priority = src->low_priority;
+  credit = src->credit_window > 0;
+  cancellable = g_object_ref (src->standby_cancellable);
+  GST_OBJECT_UNLOCK (src);
+
+  if (!dbus) {
+    dbus = g_bus_get_sync (G_BUS_TYPE_SESSION, cancellable, &err);
+    if (!dbus)
+      goto done;
+  }
+
+  /* The server won't send anything until we wake it up in failover */
+  while (!call_attach (dbus, bus_name, object_path,
+          attach_options (max_framerate, low_priority, credit, TRUE), &scaps,
+          &fdlist, cancellable, &err)) {
+    if (!is_dbus_error_recoverable (err))
+      goto done;
+    GST_DEBUG_OBJECT (src, "Standby attach to %s failed: %s.  Retrying",
+        bus_name, err->message);
+    g_clear_error (&err);
+    if (!wait_for_retry (context, cancellable, attempt++, NULL))
+      goto done;
+  }
+
+  fds = g_unix_fd_list_steal_fds (fdlist, NULL);
+  socket = g_socket_new_from_fd (fds[0], &err);
+  if (!socket)
+    goto done;
+
+  GST_INFO_OBJECT (src, "Attached to %s as the standby", bus_name);
+  GST_OBJECT_LOCK (src);
+  SWAP (socket, src->standby_socket);
+  SWAP (scaps, src->standby_caps);
+  src->standby_to_primary = to_primary;
+  GST_OBJECT_UNLOCK (src);
+
+done:
+  if (err)
+    GST_WARNING_OBJECT (src, "Failed to attach to %s as the standby: %s",
+        bus_name, err->message);
+  GST_OBJECT_LOCK (src);
+  src->standby_attaching = FALSE;
+  GST_OBJECT_UNLOCK (src);
+
+  g_clear_error (&err);
+  g_clear_object (&dbus);
+  g_clear_object (&fdlist);
+  g_clear_object (&socket);
+  g_main_context_unref (context);
+  g_object_unref (cancellable);
+  g_free (bus_name);
+  g_free (object_path);
+  g_free (scaps);
+  g_free (fds);
+  return NULL;
+}
+
+/* Attaches to whichever of "bus-name" and "standby-bus-name" we aren't
+ * receiving from, in the background, unless we already have that standby or
+ * are busy attaching it */
+static void
+gst_pulsevideo_src_start_standby (GstPulseVideoSrc * src)
+{
+  GThread *thread;
+
+  GST_OBJECT_LOCK (src);
+  if (!src->standby_bus_name || src->standby_attaching ||
+      (src->standby_socket && src->standby_to_primary == src->on_standby)) {
+    GST_OBJECT_UNLOCK (src);
+    return;
+  }
+  thread = g_steal_pointer (&src->standby_thread);
+  src->standby_attaching = TRUE;
+  src->standby_target_primary = src->on_standby;
+  GST_OBJECT_UNLOCK (src);
+
+  /* Finished, as it's no longer attaching */
+  if (thread)
+    g_thread_join (thread);
+
+  thread = g_thread_new ("pvstandby", gst_pulsevideo_src_standby_thread, src);
+  GST_OBJECT_LOCK (src);
+  src->standby_thread = thread;
+  GST_OBJECT_UNLOCK (src);
+}
+
+static void
+gst_pulsevideo_src_stop_standby (GstPulseVideoSrc * src)
+{
+  GThread *thread;
+  GSocket *socket;
+
+  g_cancellable_cancel (src->standby_cancellable);
+  GST_OBJECT_LOCK (src);
+  thread = g_steal_pointer (&src->standby_thread);
+  GST_OBJECT_UNLOCK (src);
+  if (thread)
+    g_thread_join (thread);
+  g_cancellable_reset (src->standby_cancellable);
+
+  GST_OBJECT_LOCK (src);
+  socket = g_steal_pointer (&src->standby_socket);
+  g_clear_pointer (&src->standby_caps, g_free);
+  src->on_standby = FALSE;
+  src->failed_over = FALSE;
+  GST_OBJECT_UNLOCK (src);
+  g_clear_object (&socket);
+}
+
+/* Called when the video source we're receiving from has gone away.  Switches
+ * socketsrc over to the standby without any round trips and attaches to the
+ * video source that went away as the new standby.  Returns FALSE if there's
+ * no standby to switch to. */
+static gboolean
+gst_pulsevideo_src_failover (GstPulseVideoSrc * src)
+{
+  GSocket *socket;
+  gchar *scaps;
+  GstCaps *caps;
+  CreditMessage wakeup = { CREDIT_MESSAGE_MAGIC, 0 };
+  GError *err = NULL;
+
+  GST_OBJECT_LOCK (src);
+  socket = g_steal_pointer (&src->standby_socket);
+  scaps = g_steal_pointer (&src->standby_caps);
+  if (socket && src->standby_to_primary != src->on_standby) {
+    /* Attached to the one that went away.  Only after a reinit could we have
+     * a standby like this. */
+    g_clear_object (&socket);
+  } else if (socket) {
+    src->on_standby = !src->standby_to_primary;
+    src->failed_over = TRUE;
+  }
+  GST_OBJECT_UNLOCK (src);
+
+  if (!socket) {
+    g_free (scaps);
+    return FALSE;
+  }
+
+  caps = gst_caps_from_string (scaps);
+  g_object_set (src->capsfilter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_free (scaps);
+
+  /* Wakes the standby up on the server side.  With credit based flow control
+   * socketsrc grants the real credit when it starts receiving. */
+  if (g_socket_send (socket, (const gchar *) &wakeup, sizeof (wakeup), NULL,
+          &err) != sizeof (wakeup)) {
+    GST_WARNING_OBJECT (src, "Failed to wake up the standby: %s",
+        err ? err->message : "short write");
+    g_clear_error (&err);
+  }
+
+  g_object_set (src->socketsrc, "socket", socket, "do-timestamp", TRUE, NULL);
+  g_object_unref (socket);
+  GST_INFO_OBJECT (src, "VideoSource has gone away, switched to the standby");
+
+  gst_pulsevideo_src_start_standby (src);
+  return TRUE;
+}
+
 /* create a socket for connecting to remote server */
 static gboolean
 gst_pulsevideo_src_start (GstPulseVideoSrc * src)
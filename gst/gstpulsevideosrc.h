@@ -39,6 +39,9 @@ G_BEGIN_DECLS
 #define GST_IS_PULSEVIDEO_SRC_CLASS(klass) \
   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_PULSEVIDEO_SRC))
 
+/* Latency percentiles are over this many of the most recent frames */
+#define GST_PULSEVIDEO_SRC_LATENCY_WINDOW 1024
+
 typedef struct _GstPulseVideoSrc GstPulseVideoSrc;
 typedef struct _GstPulseVideoSrcClass GstPulseVideoSrcClass;
 
@@ -49,9 +52,61 @@ struct _GstPulseVideoSrc {
   GstElement *socketsrc;
   GstElement *fddepay;
   GstElement *capsfilter;
+  GstElement *rawvideovalidate;
+  /* Leaky queue of one buffer after rawvideovalidate.  Only in the bin in
+   * "mailbox" mode. */
+  GstElement *mailbox;
+  guint64 mailbox_dropped;
   GDBusConnection *dbus;
   gchar *bus_name;
   gchar *object_path;
+  gint max_framerate_n;
+  gint max_framerate_d;
+  gboolean low_priority;
+  guint credit_window;
+  gboolean direct_attach;
+  /* VideoSource2.DirectAddress from our last attach */
+  gchar *direct_address;
+  /* GstVideoSource2 proxy kept between reattaches so that we hear when the
+   * bus name gets a new owner.  Its signals are dispatched on dbus_context,
+   * which we only iterate while waiting to retry an attach. */
+  GDBusProxy *videosource;
+  GMainContext *dbus_context;
+  gboolean name_appeared;
+
+  /* Warm standby, see "standby-bus-name".  Guarded by the object lock. */
+  gchar *standby_bus_name;
+  /* An idle attachment using credit based flow control with no credit
+   * granted, so nothing is sent on it until we switch to it */
+  GSocket *standby_socket;
+  gchar *standby_caps;
+  /* Whether standby_socket is attached to "bus-name" rather than to
+   * "standby-bus-name" */
+  gboolean standby_to_primary;
+  /* Whether we're receiving from "standby-bus-name" */
+  gboolean on_standby;
+  /* Until the first frame from a standby we've switched to that doesn't take
+   * PTS backwards */
+  gboolean failed_over;
+  /* Attaches the standby so that it doesn't hold up streaming */
+  GThread *standby_thread;
+  gboolean standby_attaching;
+  gboolean standby_target_primary;
+  GCancellable *standby_cancellable;
+
+  /* Capture-to-arrival latency of the frames we've pushed since we started.
+   * Guarded by the object lock. */
+  guint64 frames;
+  GstClockTime latency_min;
+  GstClockTime latency_max;
+  GstClockTime latency_sum;
+  GstClockTime latency_window[GST_PULSEVIDEO_SRC_LATENCY_WINDOW];
+  guint64 gaps;
+  GstClockTime last_pts;
+  /* From the framerate in our caps, 0 if unknown */
+  GstClockTime frame_duration;
+  GstClockTime stats_interval;
+  GstClockID stats_clock_id;
 };
 
 struct _GstPulseVideoSrcClass {
@@ -0,0 +1,621 @@
+/* GStreamer
+ * Copyright (C) <2016> William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:gstsocketring
+ * @short_description: Shared io_uring receive path for socketsrc
+ *
+ * A client subscribed to many video sources would otherwise make a recvmsg
+ * (and often a poll) per frame per source.  Here one io_uring serves every
+ * socket in the process.  Each socket has a multishot recvmsg outstanding
+ * with buffers picked by the kernel from a ring we provide, so receiving a
+ * message takes no system calls at all from the thread that wants it.  A
+ * single thread reaps the completions, copies the messages out of the
+ * provided buffers, hands the buffers straight back and wakes whoever is
+ * waiting.
+ *
+ * Each receiver only queues a few messages ahead of its reader.  Once it has
+ * that many the recvmsg is cancelled and the rest stay in the socket, so the
+ * sender still sees backpressure and we don't collect the fds of frames
+ * nobody is reading.  The recvmsg is started again as the reader catches up.
+ *
+ * The ring and its thread are created for the first receiver and torn down
+ * when the last one is freed.
+ *
+ * Only built with liburing.  gst_socket_ring_receiver_new() returns %NULL if
+ * it isn't, or if the kernel won't give us an io_uring, and the caller should
+ * use g_socket_receive_message() instead.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstsocketring.h"
+
+#ifdef HAVE_LIBURING
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <gst/gst.h>
+#include <gio/gunixfdmessage.h>
+#include <liburing.h>
+
+GST_DEBUG_CATEGORY_STATIC (socketring_debug);
+#define GST_CAT_DEFAULT socketring_debug
+
+#define RING_ENTRIES 64
+/* Must be a power of 2 */
+#define RING_BUFFERS 256
+#define RING_BUFFER_GROUP 0
+/* Bigger messages are split like a short read from recvmsg would */
+#define RING_PAYLOAD_SIZE 4096
+#define RING_MAX_FDS 16
+
+typedef struct
+{
+  struct io_uring uring;
+  struct io_uring_buf_ring *buf_ring;
+  guint8 *buffers;
+  gsize buffer_size;
+
+  /* Tells the kernel how much space to leave for the address and control
+   * messages in each provided buffer */
+  struct msghdr msg;
+
+  /* liburing doesn't protect the submission queue.  Completions are only
+   * touched by our thread. */
+  GMutex submit_lock;
+  GThread *thread;
+
+  /* Protected by ring_lock */
+  guint n_receivers;
+} GstSocketRing;
+
+typedef struct
+{
+  guint8 *data;
+  gsize size;
+  gsize offset;                 /* how much has been received already */
+  GList *control_messages;      /* GSocketControlMessage */
+} RingMessage;
+
+struct _GstSocketRingReceiver
+{
+  GstSocketRing *ring;
+  GSocket *socket;
+  guint max_queued;
+
+  GMutex lock;
+  GCond cond;
+  GQueue messages;              /* RingMessage */
+  gboolean armed;               /* a multishot recvmsg is outstanding */
+  gboolean pausing;             /* and we've cancelled it, @messages is full */
+  gboolean closing;
+  gboolean eos;
+  gint error;                   /* errno of the receive that failed */
+};
+
+/* The ring shared by all receivers, while there are any */
+static GMutex ring_lock;
+static GstSocketRing *shared_ring = NULL;
+/* Set when we can't have an io_uring at all */
+static gboolean ring_unavailable = FALSE;
+
+/* Set when the kernel turns out not to support multishot recvmsg */
+static gint ring_unsupported = 0;
+
+static void
+ring_message_free (RingMessage * msg)
+{
+  g_free (msg->data);
+  g_list_free_full (msg->control_messages, g_object_unref);
+  g_slice_free (RingMessage, msg);
+}
+
+static struct io_uring_sqe *
+gst_socket_ring_get_sqe (GstSocketRing * ring)
+{
+  struct io_uring_sqe *sqe;
+
+  while ((sqe = io_uring_get_sqe (&ring->uring)) == NULL)
+    io_uring_submit (&ring->uring);
+  return sqe;
+}
+
+static void
+gst_socket_ring_arm (GstSocketRing * ring, GstSocketRingReceiver * receiver)
+{
+  struct io_uring_sqe *sqe;
+  gboolean closing;
+
+  /* Holding submit_lock while we check closing means that a cancel from
+   * gst_socket_ring_receiver_free() is either submitted after this recvmsg
+   * or sees that we didn't submit it */
+  g_mutex_lock (&ring->submit_lock);
+  g_mutex_lock (&receiver->lock);
+  closing = receiver->closing;
+  receiver->armed = !closing;
+  g_cond_broadcast (&receiver->cond);
+  g_mutex_unlock (&receiver->lock);
+
+  if (!closing) {
+    sqe = gst_socket_ring_get_sqe (ring);
+    io_uring_prep_recvmsg_multishot (sqe, g_socket_get_fd (receiver->socket),
+        &ring->msg, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RING_BUFFER_GROUP;
+    io_uring_sqe_set_data (sqe, receiver);
+    io_uring_submit (&ring->uring);
+  }
+  g_mutex_unlock (&ring->submit_lock);
+}
+
+/* Cancels @receiver's recvmsg.  Its completion will come without
+ * IORING_CQE_F_MORE. */
+static void
+gst_socket_ring_cancel (GstSocketRing * ring, GstSocketRingReceiver * receiver)
+{
+  struct io_uring_sqe *sqe;
+
+  g_mutex_lock (&ring->submit_lock);
+  sqe = gst_socket_ring_get_sqe (ring);
+  io_uring_prep_cancel (sqe, receiver, 0);
+  io_uring_sqe_set_data (sqe, NULL);
+  io_uring_submit (&ring->uring);
+  g_mutex_unlock (&ring->submit_lock);
+}
+
+/* Copies the message out of the provided buffer that @cqe used and gives the
+ * buffer back to the kernel */
+static RingMessage *
+gst_socket_ring_take_buffer (GstSocketRing * ring, struct io_uring_cqe *cqe)
+{
+  guint bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+  guint8 *buffer = ring->buffers + bid * ring->buffer_size;
+  struct io_uring_recvmsg_out *out = NULL;
+  struct cmsghdr *cmsg;
+  GSocketControlMessage *control;
+  RingMessage *msg = NULL;
+
+  if (cqe->res > 0)
+    out = io_uring_recvmsg_validate (buffer, cqe->res, &ring->msg);
+
+  if (out) {
+    if (out->flags & MSG_CTRUNC)
+      GST_WARNING ("Control messages truncated, fds will have been lost");
+
+    msg = g_slice_new0 (RingMessage);
+    msg->size = io_uring_recvmsg_payload_length (out, cqe->res, &ring->msg);
+    msg->data = g_malloc (msg->size);
+    memcpy (msg->data, io_uring_recvmsg_payload (out, &ring->msg), msg->size);
+    for (cmsg = io_uring_recvmsg_cmsg_firsthdr (out, &ring->msg); cmsg;
+        cmsg = io_uring_recvmsg_cmsg_nexthdr (out, &ring->msg, cmsg)) {
+      control = g_socket_control_message_deserialize (cmsg->cmsg_level,
+          cmsg->cmsg_type,
+          cmsg->cmsg_len - ((guint8 *) CMSG_DATA (cmsg) - (guint8 *) cmsg),
+          CMSG_DATA (cmsg));
+      if (control)
+        msg->control_messages = g_list_append (msg->control_messages,
+            control);
+    }
+  }
+
+  io_uring_buf_ring_add (ring->buf_ring, buffer, ring->buffer_size, bid,
+      io_uring_buf_ring_mask (RING_BUFFERS), 0);
+  io_uring_buf_ring_advance (ring->buf_ring, 1);
+
+  return msg;
+}
+
+static void
+gst_socket_ring_complete (GstSocketRing * ring, struct io_uring_cqe *cqe)
+{
+  GstSocketRingReceiver *receiver = io_uring_cqe_get_data (cqe);
+  RingMessage *msg = NULL;
+  gboolean rearm = FALSE, pause = FALSE;
+
+  /* Completion of a cancel */
+  if (receiver == NULL)
+    return;
+
+  if (cqe->flags & IORING_CQE_F_BUFFER)
+    msg = gst_socket_ring_take_buffer (ring, cqe);
+
+  g_mutex_lock (&receiver->lock);
+  if (msg && msg->size > 0) {
+    g_queue_push_tail (&receiver->messages, msg);
+    msg = NULL;
+  } else if (msg || cqe->res == 0) {
+    receiver->eos = TRUE;
+  } else if (cqe->res == -EINVAL) {
+    GST_INFO ("Multishot recvmsg not supported");
+    g_atomic_int_set (&ring_unsupported, 1);
+    receiver->error = EINVAL;
+  } else if (cqe->res < 0 && cqe->res != -ENOBUFS &&
+      cqe->res != -ECANCELED) {
+    receiver->error = -cqe->res;
+  }
+
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    /* The recvmsg has finished.  Start another if we ran out of buffers or it
+     * was cancelled because the thread that submitted it exited, but not if
+     * we're being freed or the reader is behind.  We stay armed until then so
+     * that we can't be freed. */
+    rearm = !receiver->closing && !receiver->eos && receiver->error == 0 &&
+        g_queue_get_length (&receiver->messages) < receiver->max_queued;
+    receiver->armed = rearm;
+    receiver->pausing = FALSE;
+  } else if (!receiver->pausing && !receiver->closing &&
+      g_queue_get_length (&receiver->messages) >= receiver->max_queued) {
+    /* A few more may arrive before the cancel takes effect */
+    GST_LOG ("Receiver %p is full, pausing", receiver);
+    pause = receiver->pausing = TRUE;
+  }
+  g_cond_broadcast (&receiver->cond);
+  g_mutex_unlock (&receiver->lock);
+
+  if (msg)
+    ring_message_free (msg);
+  if (rearm)
+    gst_socket_ring_arm (ring, receiver);
+  if (pause)
+    gst_socket_ring_cancel (ring, receiver);
+}
+
+static gpointer
+gst_socket_ring_thread (gpointer data)
+{
+  GstSocketRing *ring = data;
+  struct io_uring_cqe *cqe;
+  int ret;
+
+  while (TRUE) {
+    ret = io_uring_wait_cqe (&ring->uring, &cqe);
+    if (ret == -EINTR)
+      continue;
+    if (ret < 0) {
+      GST_ERROR ("Failed waiting for io_uring completion: %s",
+          g_strerror (-ret));
+      break;
+    }
+    /* The nop from gst_socket_ring_free() */
+    if (io_uring_cqe_get_data (cqe) == ring) {
+      io_uring_cqe_seen (&ring->uring, cqe);
+      break;
+    }
+    gst_socket_ring_complete (ring, cqe);
+    io_uring_cqe_seen (&ring->uring, cqe);
+  }
+  return NULL;
+}
+
+/* Called with ring_lock held */
+static GstSocketRing *
+gst_socket_ring_new (void)
+{
+  static gsize initialized = 0;
+  GstSocketRing *ring;
+  int ret, i;
+
+  if (g_once_init_enter (&initialized)) {
+    GST_DEBUG_CATEGORY_INIT (socketring_debug, "socketring", 0,
+        "Shared io_uring for socketsrc");
+    /* So g_socket_control_message_deserialize() knows about SCM_RIGHTS */
+    g_type_ensure (G_TYPE_UNIX_FD_MESSAGE);
+    g_once_init_leave (&initialized, 1);
+  }
+
+  ring = g_new0 (GstSocketRing, 1);
+  ret = io_uring_queue_init (RING_ENTRIES, &ring->uring, 0);
+  if (ret < 0) {
+    GST_INFO ("io_uring not available: %s", g_strerror (-ret));
+    g_free (ring);
+    return NULL;
+  }
+
+  ring->msg.msg_controllen = CMSG_SPACE (sizeof (int) * RING_MAX_FDS);
+  ring->buffer_size = sizeof (struct io_uring_recvmsg_out) +
+      ring->msg.msg_controllen + RING_PAYLOAD_SIZE;
+  ring->buf_ring = io_uring_setup_buf_ring (&ring->uring, RING_BUFFERS,
+      RING_BUFFER_GROUP, 0, &ret);
+  if (ring->buf_ring == NULL) {
+    GST_INFO ("Can't provide buffers to io_uring: %s", g_strerror (-ret));
+    io_uring_queue_exit (&ring->uring);
+    g_free (ring);
+    return NULL;
+  }
+  ring->buffers = g_malloc (ring->buffer_size * RING_BUFFERS);
+  for (i = 0; i < RING_BUFFERS; i++)
+    io_uring_buf_ring_add (ring->buf_ring,
+        ring->buffers + i * ring->buffer_size, ring->buffer_size, i,
+        io_uring_buf_ring_mask (RING_BUFFERS), i);
+  io_uring_buf_ring_advance (ring->buf_ring, RING_BUFFERS);
+
+  g_mutex_init (&ring->submit_lock);
+  ring->thread = g_thread_new ("socketring", gst_socket_ring_thread, ring);
+
+  return ring;
+}
+
+/* Called with ring_lock held once every receiver has gone, so nothing is
+ * outstanding but the nop we use to stop the thread */
+static void
+gst_socket_ring_free (GstSocketRing * ring)
+{
+  struct io_uring_sqe *sqe;
+
+  g_mutex_lock (&ring->submit_lock);
+  sqe = gst_socket_ring_get_sqe (ring);
+  io_uring_prep_nop (sqe);
+  io_uring_sqe_set_data (sqe, ring);
+  io_uring_submit (&ring->uring);
+  g_mutex_unlock (&ring->submit_lock);
+
+  g_thread_join (ring->thread);
+
+  io_uring_free_buf_ring (&ring->uring, ring->buf_ring, RING_BUFFERS,
+      RING_BUFFER_GROUP);
+  io_uring_queue_exit (&ring->uring);
+  g_free (ring->buffers);
+  g_mutex_clear (&ring->submit_lock);
+  g_free (ring);
+}
+
+static GstSocketRing *
+gst_socket_ring_ref (void)
+{
+  GstSocketRing *ring;
+
+  g_mutex_lock (&ring_lock);
+  if (shared_ring == NULL && !ring_unavailable) {
+    shared_ring = gst_socket_ring_new ();
+    ring_unavailable = (shared_ring == NULL);
+  }
+  ring = shared_ring;
+  if (ring)
+    ring->n_receivers++;
+  g_mutex_unlock (&ring_lock);
+
+  return ring;
+}
+
+static void
+gst_socket_ring_unref (GstSocketRing * ring)
+{
+  g_mutex_lock (&ring_lock);
+  if (--ring->n_receivers == 0) {
+    GST_DEBUG ("Last receiver gone, shutting down the io_uring");
+    gst_socket_ring_free (ring);
+    shared_ring = NULL;
+  }
+  g_mutex_unlock (&ring_lock);
+}
+
+/**
+ * gst_socket_ring_receiver_new:
+ * @socket: the socket to receive from
+ * @max_queued: how many messages to take off @socket before they are read
+ *
+ * Starts receiving from @socket.  Anything else reading from @socket after
+ * this will miss messages.
+ *
+ * Returns: a new receiver or %NULL if io_uring can't be used
+ */
+GstSocketRingReceiver *
+gst_socket_ring_receiver_new (GSocket * socket, guint max_queued)
+{
+  GstSocketRing *ring;
+  GstSocketRingReceiver *receiver;
+
+  g_return_val_if_fail (max_queued > 0, NULL);
+
+  if (g_atomic_int_get (&ring_unsupported))
+    return NULL;
+  ring = gst_socket_ring_ref ();
+  if (ring == NULL)
+    return NULL;
+
+  receiver = g_slice_new0 (GstSocketRingReceiver);
+  receiver->ring = ring;
+  receiver->socket = g_object_ref (socket);
+  receiver->max_queued = max_queued;
+  g_mutex_init (&receiver->lock);
+  g_cond_init (&receiver->cond);
+  g_queue_init (&receiver->messages);
+
+  gst_socket_ring_arm (ring, receiver);
+
+  return receiver;
+}
+
+/**
+ * gst_socket_ring_receiver_free:
+ * @receiver: a #GstSocketRingReceiver
+ *
+ * Stops receiving from the socket.  Messages that have been received but not
+ * returned by gst_socket_ring_receiver_receive() are discarded.
+ */
+void
+gst_socket_ring_receiver_free (GstSocketRingReceiver * receiver)
+{
+  GstSocketRing *ring = receiver->ring;
+
+  g_mutex_lock (&receiver->lock);
+  receiver->closing = TRUE;
+  g_mutex_unlock (&receiver->lock);
+
+  gst_socket_ring_cancel (ring, receiver);
+
+  /* The completion thread may still be using us until it sees the recvmsg
+   * finish */
+  g_mutex_lock (&receiver->lock);
+  while (receiver->armed)
+    g_cond_wait (&receiver->cond, &receiver->lock);
+  g_mutex_unlock (&receiver->lock);
+
+  g_queue_foreach (&receiver->messages, (GFunc) ring_message_free, NULL);
+  g_queue_clear (&receiver->messages);
+  g_object_unref (receiver->socket);
+  g_mutex_clear (&receiver->lock);
+  g_cond_clear (&receiver->cond);
+  g_slice_free (GstSocketRingReceiver, receiver);
+
+  gst_socket_ring_unref (ring);
+}
+
+GSocket *
+gst_socket_ring_receiver_get_socket (GstSocketRingReceiver * receiver)
+{
+  return receiver->socket;
+}
+
+static void
+on_cancelled (GCancellable * cancellable, GstSocketRingReceiver * receiver)
+{
+  g_mutex_lock (&receiver->lock);
+  g_cond_broadcast (&receiver->cond);
+  g_mutex_unlock (&receiver->lock);
+}
+
+/**
+ * gst_socket_ring_receiver_receive:
+ * @receiver: a #GstSocketRingReceiver
+ * @buffer: where to put the data received
+ * @size: the size of @buffer
+ * @messages: (out): the control messages received with the data
+ * @num_messages: (out): the number of @messages
+ * @blocking: whether to wait for a message if there isn't one yet
+ * @cancellable: (allow-none): a #GCancellable
+ * @error: a #GError
+ *
+ * Like g_socket_receive_message() on a stream socket.  At most @size bytes of
+ * a single message are returned.  The control messages come with the first
+ * part of the message that is returned.
+ *
+ * Returns: the number of bytes received, 0 at end of stream or -1 on error.
+ * The error is %G_IO_ERROR_WOULD_BLOCK if @blocking is %FALSE and there's
+ * nothing to receive and %G_IO_ERROR_NOT_SUPPORTED if the kernel can't do
+ * this, in which case nothing will have been received.
+ */
+gssize
+gst_socket_ring_receiver_receive (GstSocketRingReceiver * receiver,
+    guint8 * buffer, gsize size, GSocketControlMessage *** messages,
+    gint * num_messages, gboolean blocking, GCancellable * cancellable,
+    GError ** error)
+{
+  RingMessage *msg;
+  gulong handler = 0;
+  gssize ret = -1;
+  gboolean rearm = FALSE;
+  GList *l;
+  gint i;
+
+  *messages = NULL;
+  *num_messages = 0;
+
+  if (blocking && cancellable)
+    handler = g_cancellable_connect (cancellable, G_CALLBACK (on_cancelled),
+        receiver, NULL);
+
+  g_mutex_lock (&receiver->lock);
+  while (blocking && g_queue_is_empty (&receiver->messages) &&
+      !receiver->eos && receiver->error == 0 &&
+      !g_cancellable_is_cancelled (cancellable))
+    g_cond_wait (&receiver->cond, &receiver->lock);
+
+  msg = g_queue_peek_head (&receiver->messages);
+  if (msg) {
+    ret = MIN (size, msg->size - msg->offset);
+    memcpy (buffer, msg->data + msg->offset, ret);
+    msg->offset += ret;
+
+    *num_messages = g_list_length (msg->control_messages);
+    if (*num_messages > 0) {
+      *messages = g_new0 (GSocketControlMessage *, *num_messages + 1);
+      for (l = msg->control_messages, i = 0; l; l = l->next, i++)
+        (*messages)[i] = l->data;
+      g_list_free (msg->control_messages);
+      msg->control_messages = NULL;
+    }
+
+    if (msg->offset == msg->size) {
+      ring_message_free (g_queue_pop_head (&receiver->messages));
+
+      /* We paused because the queue was full and now there's room */
+      rearm = !receiver->armed && !receiver->closing && !receiver->eos &&
+          receiver->error == 0 &&
+          g_queue_get_length (&receiver->messages) < receiver->max_queued;
+      if (rearm)
+        receiver->armed = TRUE;
+    }
+  } else if (receiver->eos) {
+    ret = 0;
+  } else if (receiver->error == EINVAL) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+        "Kernel doesn't support multishot recvmsg");
+  } else if (receiver->error != 0) {
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (receiver->error),
+        "Error receiving message: %s", g_strerror (receiver->error));
+  } else if (!g_cancellable_set_error_if_cancelled (cancellable, error)) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK,
+        "No message received yet");
+  }
+  g_mutex_unlock (&receiver->lock);
+
+  if (rearm)
+    gst_socket_ring_arm (receiver->ring, receiver);
+  if (handler)
+    g_cancellable_disconnect (cancellable, handler);
+
+  return ret;
+}
+
+#else /* HAVE_LIBURING */
+
+GstSocketRingReceiver *
+gst_socket_ring_receiver_new (GSocket * socket, guint max_queued)
+{
+  return NULL;
+}
+
+void
+gst_socket_ring_receiver_free (GstSocketRingReceiver * receiver)
+{
+  g_return_if_reached ();
+}
+
+GSocket *
+gst_socket_ring_receiver_get_socket (GstSocketRingReceiver * receiver)
+{
+  g_return_val_if_reached (NULL);
+}
+
+gssize
+gst_socket_ring_receiver_receive (GstSocketRingReceiver * receiver,
+    guint8 * buffer, gsize size, GSocketControlMessage *** messages,
+    gint * num_messages, gboolean blocking, GCancellable * cancellable,
+    GError ** error)
+{
+  g_return_val_if_reached (-1);
+}
+
+#endif /* HAVE_LIBURING */
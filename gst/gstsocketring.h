@@ -0,0 +1,51 @@
+/* GStreamer
+ * Copyright (C) <2016> William Manley <will@williammanley.net>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_SOCKET_RING_H__
+#define __GST_SOCKET_RING_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstSocketRingReceiver:
+ *
+ * Receives messages from a socket through an io_uring shared by the whole
+ * process.  Messages are read as soon as they arrive by a multishot recvmsg
+ * and queued until gst_socket_ring_receiver_receive() is called, up to a
+ * limit after which they are left in the socket.
+ */
+typedef struct _GstSocketRingReceiver GstSocketRingReceiver;
+
+GstSocketRingReceiver * gst_socket_ring_receiver_new (GSocket * socket,
+    guint max_queued);
+void gst_socket_ring_receiver_free (GstSocketRingReceiver * receiver);
+
+GSocket * gst_socket_ring_receiver_get_socket (
+    GstSocketRingReceiver * receiver);
+
+gssize gst_socket_ring_receiver_receive (GstSocketRingReceiver * receiver,
+    guint8 * buffer, gsize size, GSocketControlMessage *** messages,
+    gint * num_messages, gboolean blocking, GCancellable * cancellable,
+    GError ** error);
+
+G_END_DECLS
+
+#endif /* __GST_SOCKET_RING_H__ */
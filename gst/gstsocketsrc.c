@@ -48,8 +48,11 @@
 #include "config.h"
 #endif
 
+#include <string.h>
+
 #include "gstnetcontrolmessagemeta.h"
 #include "gstsocketsrc.h"
+#include "tmpfile/wire-protocol.h"
 
 GST_DEBUG_CATEGORY_STATIC (socketsrc_debug);
 #define GST_CAT_DEFAULT socketsrc_debug
@@ -65,8 +68,20 @@ enum
 {
   PROP_0,
   PROP_SOCKET,
+  PROP_CREDIT_WINDOW,
+  PROP_DRAIN,
+  PROP_DROPPED,
+  PROP_IO_URING,
 };
 
+#define DEFAULT_CREDIT_WINDOW 0
+#define DEFAULT_DRAIN FALSE
+#define DEFAULT_IO_URING FALSE
+
+/* Messages the io_uring receiver may take off the socket ahead of us without
+ * a credit window */
+#define IO_URING_MAX_QUEUED 4
+
 enum
 {
   ON_SOCKET_EOS,
@@ -114,6 +129,28 @@ gst_socket_src_class_init (GstSocketSrcClass * klass)
       g_param_spec_object ("socket", "Socket",
           "The socket to receive packets from", G_TYPE_SOCKET,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CREDIT_WINDOW,
+      g_param_spec_uint ("credit-window", "Credit window",
+          "Grant the sender credit for this many messages and then one more "
+          "for every message received, for senders that use credit based "
+          "flow control. 0 means don't send any credit", 0, G_MAXUINT32,
+          DEFAULT_CREDIT_WINDOW, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DRAIN,
+      g_param_spec_boolean ("drain", "Drain",
+          "Read all the messages waiting on the socket and only push the "
+          "newest, so that we catch up straight away after downstream has "
+          "stalled.  The buffer after a drop is marked DISCONT",
+          DEFAULT_DRAIN, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DROPPED,
+      g_param_spec_uint64 ("dropped", "Dropped",
+          "Number of messages dropped in drain mode", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_IO_URING,
+      g_param_spec_boolean ("io-uring", "io_uring",
+          "Receive through an io_uring shared by all socketsrcs in the "
+          "process rather than with a recvmsg per message.  Falls back to "
+          "recvmsg if io_uring isn't available", DEFAULT_IO_URING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gst_socket_src_signals[ON_SOCKET_EOS] =
     g_signal_new ("on-socket-eos", G_TYPE_FROM_CLASS (klass),
@@ -142,6 +179,12 @@ gst_socket_src_init (GstSocketSrc * this)
 {
   this->socket = NULL;
   this->cancellable = g_cancellable_new ();
+  this->credit_window = DEFAULT_CREDIT_WINDOW;
+  this->credit_socket = NULL;
+  this->drain = DEFAULT_DRAIN;
+  this->dropped = 0;
+  this->io_uring = DEFAULT_IO_URING;
+  this->receiver = NULL;
 }
 
 static void
@@ -155,16 +198,179 @@ gst_socket_src_finalize (GObject * gobject)
   if (this->socket)
     g_object_unref (this->socket);
   this->socket = NULL;
+  g_clear_object (&this->credit_socket);
+  g_clear_pointer (&this->receiver, gst_socket_ring_receiver_free);
 
   G_OBJECT_CLASS (parent_class)->finalize (gobject);
 }
 
+/* A failure to send credit is only logged, we'll find out about the socket
+ * being closed when receiving */
+static void
+gst_socket_src_send_credit (GstSocketSrc * src, GSocket * socket,
+    guint credit)
+{
+  CreditMessage msg = { CREDIT_MESSAGE_MAGIC, credit };
+  GError *err = NULL;
+
+  if (g_socket_send (socket, (const gchar *) &msg, sizeof (msg),
+          src->cancellable, &err) != sizeof (msg)) {
+    GST_WARNING_OBJECT (src, "Failed to send %u credit: %s", credit,
+        err ? err->message : "short write");
+    g_clear_error (&err);
+  }
+}
+
+/* Number of messages we ask for at a time when draining */
+#define DRAIN_BATCH 16
+
+static gboolean
+remove_net_control_message_meta (GstBuffer * buffer, GstMeta ** meta,
+    gpointer user_data)
+{
+  if ((*meta)->info->api == GST_NET_CONTROL_MESSAGE_META_API_TYPE)
+    *meta = NULL;
+  return TRUE;
+}
+
+/* Returns TRUE if we're receiving from @socket through the shared io_uring.
+ * Once we are we carry on even if "io-uring" is turned off because the
+ * receiver may have taken messages off the socket already.  It only reads as
+ * far ahead of us as our credit window allows, or IO_URING_MAX_QUEUED without
+ * one, leaving the rest in the socket for the sender to see. */
+static gboolean
+gst_socket_src_ensure_receiver (GstSocketSrc * src, GSocket * socket,
+    gboolean io_uring, guint credit_window)
+{
+  if (src->receiver &&
+      gst_socket_ring_receiver_get_socket (src->receiver) != socket)
+    g_clear_pointer (&src->receiver, gst_socket_ring_receiver_free);
+
+  if (src->receiver == NULL && io_uring) {
+    src->receiver = gst_socket_ring_receiver_new (socket,
+        credit_window > 0 ? credit_window : IO_URING_MAX_QUEUED);
+    GST_DEBUG_OBJECT (src, "%s io_uring for socket %p",
+        src->receiver ? "Using" : "Can't use", socket);
+  }
+
+  return src->receiver != NULL;
+}
+
+/* gst_socket_src_drain() for when we're receiving through the io_uring.
+ * Everything that has arrived is already waiting for us in the receiver. */
+static guint
+gst_socket_src_drain_ring (GstSocketSrc * src, GSocket * socket,
+    GstBuffer * outbuf, gsize msg_size, guint credit_window)
+{
+  GSocketControlMessage **cmsgs;
+  gint n_cmsgs, i;
+  guint8 *data;
+  guint dropped = 0;
+  gssize n;
+
+  data = g_malloc (msg_size);
+  while ((n = gst_socket_ring_receiver_receive (src->receiver, data,
+              msg_size, &cmsgs, &n_cmsgs, FALSE, NULL, NULL)) > 0) {
+    gst_buffer_foreach_meta (outbuf, remove_net_control_message_meta, NULL);
+    gst_buffer_set_size (outbuf, n);
+    gst_buffer_fill (outbuf, 0, data, n);
+    for (i = 0; i < n_cmsgs; i++) {
+      gst_buffer_add_net_control_message_meta (outbuf, cmsgs[i]);
+      g_object_unref (cmsgs[i]);
+    }
+    g_free (cmsgs);
+    dropped++;
+
+    if (credit_window > 0)
+      gst_socket_src_send_credit (src, socket, 1);
+  }
+  g_free (data);
+
+  return dropped;
+}
+
+/* In drain mode we take all the messages that are already waiting on @socket
+ * and only keep the newest in @outbuf.  The control messages of the ones it
+ * supersedes are freed without being looked at, which closes any fds they
+ * carried.  Returns the number of messages dropped. */
+static guint
+gst_socket_src_drain (GstSocketSrc * src, GSocket * socket,
+    GstBuffer * outbuf, gsize msg_size, guint credit_window)
+{
+  GInputVector vecs[DRAIN_BATCH];
+  GInputMessage msgs[DRAIN_BATCH];
+  GSocketControlMessage **cmsgs[DRAIN_BATCH];
+  guint n_cmsgs[DRAIN_BATCH];
+  guint8 *data = NULL;
+  GError *err = NULL;
+  guint dropped = 0, received;
+  gboolean eos = FALSE;
+  gint i, n;
+  guint j;
+
+  if (src->receiver)
+    return gst_socket_src_drain_ring (src, socket, outbuf, msg_size,
+        credit_window);
+
+  while (!eos && (g_socket_condition_check (socket, G_IO_IN) & G_IO_IN)) {
+    if (data == NULL)
+      data = g_malloc (DRAIN_BATCH * msg_size);
+    memset (msgs, 0, sizeof (msgs));
+    for (i = 0; i < DRAIN_BATCH; i++) {
+      vecs[i].buffer = data + i * msg_size;
+      vecs[i].size = msg_size;
+      cmsgs[i] = NULL;
+      n_cmsgs[i] = 0;
+      msgs[i].vectors = &vecs[i];
+      msgs[i].num_vectors = 1;
+      msgs[i].control_messages = &cmsgs[i];
+      msgs[i].num_control_messages = &n_cmsgs[i];
+    }
+
+    /* There's something to read so this won't block */
+    n = g_socket_receive_messages (socket, msgs, DRAIN_BATCH, 0,
+        src->cancellable, &err);
+    if (n <= 0) {
+      GST_DEBUG_OBJECT (src, "Stopped draining: %s",
+          err ? err->message : "no messages");
+      g_clear_error (&err);
+      break;
+    }
+
+    received = 0;
+    for (i = 0; i < n; i++) {
+      if (msgs[i].bytes_received == 0) {
+        /* EOS.  We'll see it again on our next read. */
+        eos = TRUE;
+      } else {
+        gst_buffer_foreach_meta (outbuf, remove_net_control_message_meta,
+            NULL);
+        gst_buffer_set_size (outbuf, msgs[i].bytes_received);
+        gst_buffer_fill (outbuf, 0, vecs[i].buffer, msgs[i].bytes_received);
+        for (j = 0; j < n_cmsgs[i]; j++)
+          gst_buffer_add_net_control_message_meta (outbuf, cmsgs[i][j]);
+        received++;
+      }
+      for (j = 0; j < n_cmsgs[i]; j++)
+        g_object_unref (cmsgs[i][j]);
+      g_free (cmsgs[i]);
+    }
+    dropped += received;
+
+    if (credit_window > 0 && received > 0)
+      gst_socket_src_send_credit (src, socket, received);
+  }
+
+  g_free (data);
+  return dropped;
+}
+
 static GstFlowReturn
 gst_socket_src_fill (GstPushSrc * psrc, GstBuffer * outbuf)
 {
   GstSocketSrc *src;
   GstFlowReturn ret = GST_FLOW_OK;
-  gssize rret;
+  gssize rret = -1;
   GError *err = NULL;
   GstMapInfo map;
   GSocket *socket = NULL;
@@ -173,6 +379,10 @@ gst_socket_src_fill (GstPushSrc * psrc, GstBuffer * outbuf)
   gint i;
   GInputVector ivec;
   gint flags = 0;
+  guint credit_window;
+  gboolean drain, io_uring;
+  gsize msg_size;
+  guint dropped;
 
   src = GST_SOCKET_SRC (psrc);
 
@@ -180,6 +390,9 @@ gst_socket_src_fill (GstPushSrc * psrc, GstBuffer * outbuf)
 
   if (src->socket)
     socket = g_object_ref (src->socket);
+  credit_window = src->credit_window;
+  drain = src->drain;
+  io_uring = src->io_uring;
 
   GST_OBJECT_UNLOCK (src);
 
@@ -189,12 +402,33 @@ gst_socket_src_fill (GstPushSrc * psrc, GstBuffer * outbuf)
   GST_LOG_OBJECT (src, "asked for a buffer");
 
 retry:
+  /* the sender doesn't send anything until we've granted our window on a new
+   * socket.  credit_socket is only used from the streaming thread. */
+  if (credit_window > 0 && socket != src->credit_socket) {
+    GST_DEBUG_OBJECT (src, "Granting credit window of %u on socket %p",
+        credit_window, socket);
+    gst_socket_src_send_credit (src, socket, credit_window);
+    g_set_object (&src->credit_socket, socket);
+  }
+
   gst_buffer_map (outbuf, &map, GST_MAP_READWRITE);
   ivec.buffer = map.data;
   ivec.size = map.size;
-  rret =
-      g_socket_receive_message (socket, NULL, &ivec, 1, &messages,
-      &num_messages, &flags, src->cancellable, &err);
+  msg_size = map.size;
+  if (gst_socket_src_ensure_receiver (src, socket, io_uring, credit_window)) {
+    rret = gst_socket_ring_receiver_receive (src->receiver, map.data,
+        map.size, &messages, &num_messages, TRUE, src->cancellable, &err);
+    if (rret < 0 && g_error_matches (err, G_IO_ERROR,
+            G_IO_ERROR_NOT_SUPPORTED)) {
+      GST_INFO_OBJECT (src, "Falling back to recvmsg: %s", err->message);
+      g_clear_error (&err);
+      g_clear_pointer (&src->receiver, gst_socket_ring_receiver_free);
+    }
+  }
+  if (src->receiver == NULL)
+    rret =
+        g_socket_receive_message (socket, NULL, &ivec, 1, &messages,
+        &num_messages, &flags, src->cancellable, &err);
   gst_buffer_unmap (outbuf, &map);
 
   for (i = 0; i < num_messages; i++) {
@@ -249,6 +483,23 @@ retry:
     ret = GST_FLOW_OK;
     gst_buffer_resize (outbuf, 0, rret);
 
+    /* we've taken this message out of the socket, so the sender can send
+     * another one */
+    if (credit_window > 0)
+      gst_socket_src_send_credit (src, socket, 1);
+
+    if (drain) {
+      dropped = gst_socket_src_drain (src, socket, outbuf, msg_size,
+          credit_window);
+      if (dropped > 0) {
+        GST_DEBUG_OBJECT (src, "Dropped %u stale messages", dropped);
+        GST_BUFFER_FLAG_SET (outbuf, GST_BUFFER_FLAG_DISCONT);
+        GST_OBJECT_LOCK (src);
+        src->dropped += dropped;
+        GST_OBJECT_UNLOCK (src);
+      }
+    }
+
     GST_LOG_OBJECT (src,
         "Returning buffer from _get of size %" G_GSIZE_FORMAT ", ts %"
         GST_TIME_FORMAT ", dur %" GST_TIME_FORMAT
@@ -287,6 +538,21 @@ gst_socket_src_set_property (GObject * object, guint prop_id,
       g_clear_object (&socket);
       break;
     }
+    case PROP_CREDIT_WINDOW:
+      GST_OBJECT_LOCK (socketsrc);
+      socketsrc->credit_window = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (socketsrc);
+      break;
+    case PROP_DRAIN:
+      GST_OBJECT_LOCK (socketsrc);
+      socketsrc->drain = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (socketsrc);
+      break;
+    case PROP_IO_URING:
+      GST_OBJECT_LOCK (socketsrc);
+      socketsrc->io_uring = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (socketsrc);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -303,6 +569,26 @@ gst_socket_src_get_property (GObject * object, guint prop_id,
     case PROP_SOCKET:
       g_value_set_object (value, socketsrc->socket);
       break;
+    case PROP_CREDIT_WINDOW:
+      GST_OBJECT_LOCK (socketsrc);
+      g_value_set_uint (value, socketsrc->credit_window);
+      GST_OBJECT_UNLOCK (socketsrc);
+      break;
+    case PROP_DRAIN:
+      GST_OBJECT_LOCK (socketsrc);
+      g_value_set_boolean (value, socketsrc->drain);
+      GST_OBJECT_UNLOCK (socketsrc);
+      break;
+    case PROP_DROPPED:
+      GST_OBJECT_LOCK (socketsrc);
+      g_value_set_uint64 (value, socketsrc->dropped);
+      GST_OBJECT_UNLOCK (socketsrc);
+      break;
+    case PROP_IO_URING:
+      GST_OBJECT_LOCK (socketsrc);
+      g_value_set_boolean (value, socketsrc->io_uring);
+      GST_OBJECT_UNLOCK (socketsrc);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
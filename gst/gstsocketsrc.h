@@ -28,6 +28,8 @@
 
 #include <gio/gio.h>
 
+#include "gstsocketring.h"
+
 G_BEGIN_DECLS
 
 #define GST_TYPE_SOCKET_SRC \
@@ -50,6 +52,16 @@ struct _GstSocketSrc {
  /*< private >*/
   GSocket *socket;
   GCancellable *cancellable;
+
+  guint credit_window;
+  GSocket *credit_socket;       /* the socket we granted our window on */
+
+  gboolean drain;
+  guint64 dropped;
+
+  gboolean io_uring;
+  /* Only used from the streaming thread */
+  GstSocketRingReceiver *receiver;
 };
 
 struct _GstSocketSrcClass {
@@ -112,6 +112,9 @@
 #include <netinet/in.h>
 #endif
 
+#include <string.h>
+#include <time.h>
+
 #define NOT_IMPLEMENTED 0
 
 static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
@@ -152,6 +155,7 @@ enum
 #define DEFAULT_UNITS_SOFT_MAX          -1
 #define DEFAULT_RECOVER_POLICY          GST_RECOVER_POLICY_NONE
 #define DEFAULT_TIMEOUT                 0
+#define DEFAULT_MAX_FRAME_AGE           0
 #define DEFAULT_SYNC_METHOD             GST_SYNC_METHOD_LATEST
 
 #define DEFAULT_BURST_FORMAT            GST_FORMAT_UNDEFINED
@@ -161,6 +165,10 @@ enum
 
 #define DEFAULT_RESEND_STREAMHEADER      TRUE
 
+#define DEFAULT_INLINE_SEND             FALSE
+#define DEFAULT_ADAPTIVE_LIMITS         FALSE
+#define DEFAULT_BURST_LATEST            0
+
 enum
 {
   PROP_0,
@@ -181,6 +189,7 @@ enum
 
   PROP_RECOVER_POLICY,
   PROP_TIMEOUT,
+  PROP_MAX_FRAME_AGE,
   PROP_SYNC_METHOD,
   PROP_BYTES_TO_SERVE,
   PROP_BYTES_SERVED,
@@ -194,6 +203,11 @@ enum
 
   PROP_NUM_HANDLES,
 
+  PROP_INLINE_SEND,
+  PROP_PRIORITY_STATS,
+  PROP_ADAPTIVE_LIMITS,
+  PROP_BURST_LATEST,
+
   PROP_LAST
 };
 
@@ -275,6 +289,10 @@ gst_multi_handle_sink_client_status_get_type (void)
 
 static void gst_multi_handle_sink_finalize (GObject * object);
 static void gst_multi_handle_sink_clear (GstMultiHandleSink * mhsink);
+static void gst_multi_handle_client_table_init (GstMultiHandleClientTable *
+    table);
+static void gst_multi_handle_client_table_free (GstMultiHandleClientTable *
+    table);
 
 static GstFlowReturn gst_multi_handle_sink_render (GstBaseSink * bsink,
     GstBuffer * buf);
@@ -395,6 +413,21 @@ gst_multi_handle_sink_class_init (GstMultiHandleSinkClass * klass)
           "Maximum inactivity timeout in nanoseconds for a client (0 = no limit)",
           0, G_MAXUINT64, DEFAULT_TIMEOUT,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  /**
+   * GstMultiHandleSink::max-frame-age
+   *
+   * Don't send buffers that have been queued for longer than this.  When a
+   * client gets round to a buffer that is too old it moves straight to the
+   * newest buffer instead, which is only sent if it is recent enough
+   * itself.  The age is the time since the sink received the buffer, so
+   * latency upstream of the sink doesn't count towards it. Skipped buffers
+   * are counted in the "buffers-stale" field of get-stats.
+   */
+  g_object_class_install_property (gobject_class, PROP_MAX_FRAME_AGE,
+      g_param_spec_uint64 ("max-frame-age", "Maximum frame age",
+          "Skip buffers queued for longer than this many nanoseconds "
+          "(0 = disabled)", 0, G_MAXUINT64, DEFAULT_MAX_FRAME_AGE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (gobject_class, PROP_SYNC_METHOD,
       g_param_spec_enum ("sync-method", "Sync Method",
           "How to sync new clients to the stream", GST_TYPE_SYNC_METHOD,
@@ -440,6 +473,63 @@ gst_multi_handle_sink_class_init (GstMultiHandleSinkClass * klass)
           "The current number of client handles",
           0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * GstMultiHandleSink::inline-send
+   *
+   * Try to write new buffers to clients that are waiting for them directly
+   * from the streaming thread. Only clients that would block are left to the
+   * sender thread. This saves a thread wakeup per buffer for fast clients.
+   */
+  g_object_class_install_property (gobject_class, PROP_INLINE_SEND,
+      g_param_spec_boolean ("inline-send", "Inline send",
+          "Write to idle clients from the streaming thread when possible",
+          DEFAULT_INLINE_SEND, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstMultiHandleSink::adaptive-limits
+   *
+   * Size the soft and hard limits of each client from how long its buffers
+   * wait in the queue before it takes them, and the jitter of that, instead
+   * of applying buffers-soft-max and buffers-max to everybody.  A client
+   * that keeps up gets a soft limit of one buffer, slower or burstier clients
+   * get more slack.  The global limits remain the upper bounds.  The chosen
+   * limits are reported as "buffers-soft-max" and "buffers-max" in
+   * get-stats, the measurements as "consumption-delay" and
+   * "consumption-jitter".
+   */
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_LIMITS,
+      g_param_spec_boolean ("adaptive-limits", "Adaptive limits",
+          "Choose the queue limits of each client from its consumption rate, "
+          "bounded by the global limits", DEFAULT_ADAPTIVE_LIMITS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstMultiHandleSink::burst-latest
+   *
+   * Start new clients with sync-method=latest on the newest N buffers that
+   * are already queued instead of making them wait for the next one.  At low
+   * frame rates this saves a new client up to a frame interval.  The queue is
+   * kept at least this long.  0 disables it.
+   */
+  g_object_class_install_property (gobject_class, PROP_BURST_LATEST,
+      g_param_spec_int ("burst-latest", "Burst latest",
+          "Number of already queued buffers to send to new clients with "
+          "sync-method=latest (0 = wait for the next buffer)", 0, G_MAXINT,
+          DEFAULT_BURST_LATEST, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstMultiHandleSink::priority-stats
+   *
+   * Send latency for each client priority class since the element was
+   * started: the number of buffers sent and the mean and maximum time between
+   * a buffer being queued and it being taken from the queue to be written,
+   * in nanoseconds.  The fields are prefixed with "high-" and "low-".
+   */
+  g_object_class_install_property (gobject_class, PROP_PRIORITY_STATS,
+      g_param_spec_boxed ("priority-stats", "Priority stats",
+          "Send latency statistics for each client priority class",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   /**
    * GstMultiHandleSink::clear:
    * @gstmultihandlesink: the multihandlesink element to emit this signal on
@@ -490,9 +580,10 @@ gst_multi_handle_sink_init (GstMultiHandleSink * this)
   GST_OBJECT_FLAG_UNSET (this, GST_MULTI_HANDLE_SINK_OPEN);
 
   CLIENTS_LOCK_INIT (this);
-  this->clients = NULL;
+  gst_multi_handle_client_table_init (&this->table);
 
   this->bufqueue = g_array_new (FALSE, TRUE, sizeof (GstBuffer *));
+  this->bufqueue_times = g_array_new (FALSE, TRUE, sizeof (GstClockTime));
   this->unit_format = DEFAULT_UNIT_FORMAT;
   this->units_max = DEFAULT_UNITS_MAX;
   this->units_soft_max = DEFAULT_UNITS_SOFT_MAX;
@@ -500,8 +591,10 @@ gst_multi_handle_sink_init (GstMultiHandleSink * this)
   this->bytes_min = DEFAULT_BYTES_MIN;
   this->buffers_min = DEFAULT_BUFFERS_MIN;
   this->recover_policy = DEFAULT_RECOVER_POLICY;
+  this->adaptive_limits = DEFAULT_ADAPTIVE_LIMITS;
 
   this->timeout = DEFAULT_TIMEOUT;
+  this->max_frame_age = DEFAULT_MAX_FRAME_AGE;
   this->def_sync_method = DEFAULT_SYNC_METHOD;
 
   this->def_burst_format = DEFAULT_BURST_FORMAT;
@@ -510,6 +603,9 @@ gst_multi_handle_sink_init (GstMultiHandleSink * this)
   this->qos_dscp = DEFAULT_QOS_DSCP;
 
   this->resend_streamheader = DEFAULT_RESEND_STREAMHEADER;
+  this->inline_send = DEFAULT_INLINE_SEND;
+  this->burst_latest = DEFAULT_BURST_LATEST;
+  this->deferred = g_array_new (FALSE, FALSE, sizeof (guint));
 }
 
 static void
@@ -521,7 +617,10 @@ gst_multi_handle_sink_finalize (GObject * object)
 
   CLIENTS_LOCK_CLEAR (this);
   g_array_free (this->bufqueue, TRUE);
+  g_array_free (this->bufqueue_times, TRUE);
+  g_array_free (this->deferred, TRUE);
   g_hash_table_destroy (this->handle_hash);
+  gst_multi_handle_client_table_free (&this->table);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -599,51 +698,575 @@ gst_multi_handle_sink_client_init (GstMultiHandleClient * client,
 {
   GTimeVal now;
 
-  client->status = GST_CLIENT_STATUS_OK;
-  client->bufpos = -1;
+  /* the hot state is initialised when the client gets its slot in
+   * gst_multi_handle_client_table_insert() */
+  client->table = NULL;
+  client->slot = G_MAXUINT;
   client->flushcount = -1;
   client->bufoffset = 0;
   client->sending = NULL;
   client->bytes_sent = 0;
-  client->dropped_buffers = 0;
+  client->buffers_stale = 0;
+  memset (client->send_latency, 0, sizeof (client->send_latency));
   client->avg_queue_size = 0;
   client->first_buffer_ts = GST_CLOCK_TIME_NONE;
   client->last_buffer_ts = GST_CLOCK_TIME_NONE;
-  client->new_connection = TRUE;
   client->sync_method = sync_method;
   client->currently_removing = FALSE;
+  client->priority = GST_CLIENT_PRIORITY_HIGH;
+  client->credit = -1;
+  client->credit_granted = 0;
+  client->consume_delay = GST_CLOCK_TIME_NONE;
+  client->consume_jitter = 0;
 
   /* update start time */
   g_get_current_time (&now);
   client->connect_time = GST_TIMEVAL_TO_TIME (now);
   client->disconnect_time = 0;
+}
+
+/* The clock used for client activity and timeouts. Timeouts are enforced
+ * with GST_MULTI_HANDLE_TIMER_TICK granularity so a coarse clock is good
+ * enough and much cheaper to read. */
+GstClockTime
+gst_multi_handle_sink_coarse_now (void)
+{
+#ifdef CLOCK_MONOTONIC_COARSE
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC_COARSE, &ts) == 0)
+    return GST_TIMESPEC_TO_TIME (ts);
+#endif
+  return g_get_monotonic_time () * GST_USECOND;
+}
+
+static void
+gst_multi_handle_client_table_init (GstMultiHandleClientTable * table)
+{
+  guint i;
+
+  memset (table, 0, sizeof (*table));
+  for (i = 0; i < G_N_ELEMENTS (table->timer_heads); i++)
+    table->timer_heads[i] = G_MAXUINT;
+  table->timer_tick =
+      gst_multi_handle_sink_coarse_now () / GST_MULTI_HANDLE_TIMER_TICK;
+}
+
+static void
+gst_multi_handle_client_table_timer_link (GstMultiHandleClientTable * table,
+    guint slot, guint list)
+{
+  guint head = table->timer_heads[list];
+
+  table->timer_prev[slot] = G_MAXUINT;
+  table->timer_next[slot] = head;
+  if (head != G_MAXUINT)
+    table->timer_prev[head] = slot;
+  table->timer_heads[list] = slot;
+  table->timer_list[slot] = list;
+}
+
+static void
+gst_multi_handle_client_table_timer_unlink (GstMultiHandleClientTable *
+    table, guint slot)
+{
+  guint prev = table->timer_prev[slot];
+  guint next = table->timer_next[slot];
+
+  if (table->timer_list[slot] == G_MAXUINT)
+    return;
+
+  if (prev != G_MAXUINT)
+    table->timer_next[prev] = next;
+  else
+    table->timer_heads[table->timer_list[slot]] = next;
+  if (next != G_MAXUINT)
+    table->timer_prev[next] = prev;
+  table->timer_list[slot] = G_MAXUINT;
+}
+
+/* put @slot in the bucket of the tick where it would time out. Activity
+ * updates don't touch the wheel, the client is simply rescheduled when its
+ * bucket comes up and it turns out to have been active in the meantime. */
+static void
+gst_multi_handle_client_table_timer_schedule (GstMultiHandleClientTable *
+    table, guint slot, GstClockTime timeout)
+{
+  guint64 tick;
+
+  tick = (table->last_activity_time[slot] + timeout) /
+      GST_MULTI_HANDLE_TIMER_TICK;
+  tick = MAX (tick, table->timer_tick);
+
+  gst_multi_handle_client_table_timer_link (table, slot,
+      tick % GST_MULTI_HANDLE_TIMER_WHEEL_SIZE);
+}
+
+static void
+gst_multi_handle_client_table_grow (GstMultiHandleClientTable * table)
+{
+  guint size = MAX (table->size * 2, 8);
+
+  table->bufpos = g_renew (gint, table->bufpos, size);
+  table->status = g_renew (GstClientStatus, table->status, size);
+  table->last_activity_time =
+      g_renew (guint64, table->last_activity_time, size);
+  table->dropped_buffers = g_renew (guint64, table->dropped_buffers, size);
+  table->new_connection = g_renew (gboolean, table->new_connection, size);
+  table->min_frame_interval =
+      g_renew (GstClockTime, table->min_frame_interval, size);
+  table->next_frame_time = g_renew (GstClockTime, table->next_frame_time, size);
+  table->wanted_soft_max = g_renew (gint, table->wanted_soft_max, size);
+  table->wanted_max = g_renew (gint, table->wanted_max, size);
+  table->client = g_renew (GstMultiHandleClient *, table->client, size);
+  table->free_slots = g_renew (guint, table->free_slots, size);
+  table->timer_next = g_renew (guint, table->timer_next, size);
+  table->timer_prev = g_renew (guint, table->timer_prev, size);
+  table->timer_list = g_renew (guint, table->timer_list, size);
+  table->size = size;
+}
+
+/* give @client a slot in @table and initialise its hot state. Must be called
+ * with the clients lock held. */
+static void
+gst_multi_handle_client_table_insert (GstMultiHandleClientTable * table,
+    GstMultiHandleClient * client, GstClockTime timeout)
+{
+  guint slot;
+
+  if (table->n_free > 0) {
+    slot = table->free_slots[--table->n_free];
+  } else {
+    if (table->end == table->size)
+      gst_multi_handle_client_table_grow (table);
+    slot = table->end++;
+  }
+
+  table->bufpos[slot] = -1;
+  table->status[slot] = GST_CLIENT_STATUS_OK;
   /* set last activity time to connect time */
-  client->last_activity_time = client->connect_time;
+  table->last_activity_time[slot] = gst_multi_handle_sink_coarse_now ();
+  table->dropped_buffers[slot] = 0;
+  table->new_connection[slot] = TRUE;
+  table->min_frame_interval[slot] = 0;
+  table->next_frame_time[slot] = 0;
+  table->wanted_soft_max[slot] = 0;
+  table->wanted_max[slot] = 0;
+  table->client[slot] = client;
+  /* without a timeout clients aren't on the wheel at all */
+  table->timer_list[slot] = G_MAXUINT;
+  if (timeout > 0)
+    gst_multi_handle_client_table_timer_schedule (table, slot, timeout);
+
+  client->table = table;
+  client->slot = slot;
+}
+
+/* release the slot of @client. The hot state of the client must not be
+ * accessed after this. Must be called with the clients lock held. */
+static void
+gst_multi_handle_client_table_remove (GstMultiHandleClientTable * table,
+    GstMultiHandleClient * client)
+{
+  g_return_if_fail (client->table == table);
+  g_return_if_fail (table->client[client->slot] == client);
+
+  gst_multi_handle_client_table_timer_unlink (table, client->slot);
+  table->client[client->slot] = NULL;
+  table->free_slots[table->n_free++] = client->slot;
+}
+
+static void
+gst_multi_handle_client_table_free (GstMultiHandleClientTable * table)
+{
+  g_free (table->bufpos);
+  g_free (table->status);
+  g_free (table->last_activity_time);
+  g_free (table->dropped_buffers);
+  g_free (table->new_connection);
+  g_free (table->min_frame_interval);
+  g_free (table->next_frame_time);
+  g_free (table->wanted_soft_max);
+  g_free (table->wanted_max);
+  g_free (table->client);
+  g_free (table->free_slots);
+  g_free (table->timer_next);
+  g_free (table->timer_prev);
+  g_free (table->timer_list);
+  gst_multi_handle_client_table_init (table);
+}
+
+/* Remove the clients that have been inactive for longer than the timeout.
+ * Only the wheel buckets for the ticks that passed since the last call are
+ * visited, so this is cheap to call for every buffer. Must be called with the
+ * clients lock held. Returns TRUE when clients were removed. */
+gboolean
+gst_multi_handle_sink_expire_clients (GstMultiHandleSink * sink,
+    GstClockTime now)
+{
+  GstMultiHandleClientTable *table = &sink->table;
+  guint64 tick = now / GST_MULTI_HANDLE_TIMER_TICK;
+  guint n;
+  gboolean removed = FALSE;
+
+  if (sink->timeout == 0) {
+    table->timer_tick = MAX (table->timer_tick, tick);
+    return FALSE;
+  }
+
+  /* after a long stall one revolution visits every client */
+  for (n = 0; table->timer_tick < tick
+      && n < GST_MULTI_HANDLE_TIMER_WHEEL_SIZE; table->timer_tick++, n++) {
+    guint bucket = table->timer_tick % GST_MULTI_HANDLE_TIMER_WHEEL_SIZE;
+    guint slot, next;
+
+    /* rescheduled clients are prepended so they are not visited again */
+    for (slot = table->timer_heads[bucket]; slot != G_MAXUINT; slot = next) {
+      next = table->timer_next[slot];
+      gst_multi_handle_client_table_timer_unlink (table, slot);
+      if (table->last_activity_time[slot] + sink->timeout < now)
+        gst_multi_handle_client_table_timer_link (table, slot,
+            GST_MULTI_HANDLE_TIMER_EXPIRED);
+      else
+        gst_multi_handle_client_table_timer_schedule (table, slot,
+            sink->timeout);
+    }
+  }
+  table->timer_tick = MAX (table->timer_tick, tick);
+
+  /* removing a client releases the lock, take them off the list one by one */
+  while (table->timer_heads[GST_MULTI_HANDLE_TIMER_EXPIRED] != G_MAXUINT) {
+    GstMultiHandleClient *mhclient;
+    guint slot = table->timer_heads[GST_MULTI_HANDLE_TIMER_EXPIRED];
+
+    gst_multi_handle_client_table_timer_unlink (table, slot);
+    mhclient = table->client[slot];
+
+    GST_WARNING_OBJECT (sink, "%s client %p timed out, removing",
+        mhclient->debug, mhclient);
+    table->status[slot] = GST_CLIENT_STATUS_SLOW;
+    /* set client to invalid position while being removed */
+    table->bufpos[slot] = -1;
+    gst_multi_handle_sink_remove_client (sink, mhclient);
+    removed = TRUE;
+  }
+
+  return removed;
+}
+
+/* The buckets the clients are in depend on the timeout so they all have to be
+ * scheduled again when it changes. When it is disabled they are taken off the
+ * wheel so they are not visited any more. */
+static void
+gst_multi_handle_sink_set_timeout (GstMultiHandleSink * sink,
+    GstClockTime timeout)
+{
+  GstMultiHandleClientTable *table = &sink->table;
+  guint slot;
+
+  CLIENTS_LOCK (sink);
+  sink->timeout = timeout;
+  for (slot = 0; slot < table->end; slot++) {
+    if (table->client[slot] == NULL)
+      continue;
+    gst_multi_handle_client_table_timer_unlink (table, slot);
+    if (timeout > 0)
+      gst_multi_handle_client_table_timer_schedule (table, slot, timeout);
+  }
+  CLIENTS_UNLOCK (sink);
 }
 
 static void
 gst_multi_handle_sink_setup_dscp (GstMultiHandleSink * mhsink)
 {
-  GList *clients;
+  guint slot;
 
   CLIENTS_LOCK (mhsink);
-  for (clients = mhsink->clients; clients; clients = clients->next) {
-    GstMultiHandleClient *client;
+  for (slot = 0; slot < mhsink->table.end; slot++) {
+    GstMultiHandleClient *client = mhsink->table.client[slot];
 
-    client = clients->data;
+    if (client == NULL)
+      continue;
 
     gst_multi_handle_sink_setup_dscp_client (mhsink, client);
   }
   CLIENTS_UNLOCK (mhsink);
 }
 
+/* apply the per-client @options given to add-with-options. Must be called
+ * with the clients lock held. */
+static void
+gst_multi_handle_sink_client_set_options (GstMultiHandleSink * sink,
+    GstMultiHandleClient * client, const GstStructure * options)
+{
+  GstMultiHandleSinkClass *mhsinkclass = GST_MULTI_HANDLE_SINK_GET_CLASS (sink);
+  const gchar *priority;
+  gboolean credit;
+  gint num, den;
+
+  if (options == NULL)
+    return;
+
+  GST_DEBUG_OBJECT (sink, "%s client options %" GST_PTR_FORMAT, client->debug,
+      options);
+
+  if (gst_structure_get_fraction (options, "max-framerate", &num, &den)) {
+    if (num > 0 && den > 0)
+      CLIENT_MIN_FRAME_INTERVAL (client) =
+          gst_util_uint64_scale_int (GST_SECOND, den, num);
+    else
+      GST_WARNING_OBJECT (sink, "%s ignoring invalid max-framerate %d/%d",
+          client->debug, num, den);
+  }
+
+  priority = gst_structure_get_string (options, "priority");
+  if (priority) {
+    GstClientPriority old = client->priority;
+
+    if (g_str_equal (priority, "high"))
+      client->priority = GST_CLIENT_PRIORITY_HIGH;
+    else if (g_str_equal (priority, "low"))
+      client->priority = GST_CLIENT_PRIORITY_LOW;
+    else
+      GST_WARNING_OBJECT (sink, "%s ignoring unknown priority \"%s\"",
+          client->debug, priority);
+
+    /* the subclass may have set up its watch with the old priority */
+    if (client->priority != old) {
+      mhsinkclass->hash_removing (sink, client);
+      mhsinkclass->hash_adding (sink, client);
+    }
+  }
+
+  /* the client starts without credit, nothing is sent until it tells us how
+   * many buffers it can take */
+  if (gst_structure_get_boolean (options, "credit", &credit) && credit)
+    client->credit = 0;
+}
+
+/* Called by the subclass with the clients lock held when @client granted us
+ * @credit more buffers. */
 void
-gst_multi_handle_sink_add_full (GstMultiHandleSink * sink,
+gst_multi_handle_sink_client_add_credit (GstMultiHandleSink * sink,
+    GstMultiHandleClient * client, guint credit)
+{
+  GstMultiHandleSinkClass *mhsinkclass = GST_MULTI_HANDLE_SINK_GET_CLASS (sink);
+  gboolean starved = client->credit == 0;
+
+  g_return_if_fail (client->credit >= 0);
+
+  client->credit = MIN ((guint64) client->credit + credit, G_MAXINT);
+  client->credit_granted += credit;
+
+  GST_LOG_OBJECT (sink, "%s granted %u credit, now %d", client->debug, credit,
+      client->credit);
+
+  /* the subclass only waits for the next grant while the client has no
+   * credit, let it wait for the client to become writable again */
+  if (starved && client->credit > 0)
+    mhsinkclass->hash_adding (sink, client);
+}
+
+/* Frame rate limiting for clients that were added with a max-framerate.
+ * Returns TRUE if @buffer comes too soon after the previous buffer that was
+ * sent to @client and should be skipped, otherwise @buffer is accounted as
+ * sent. The buffer PTS is the capture time so this is independent of how
+ * late we get to send it. */
+gboolean
+gst_multi_handle_sink_client_skip_buffer (GstMultiHandleClient * client,
+    GstBuffer * buffer)
+{
+  GstClockTime interval = CLIENT_MIN_FRAME_INTERVAL (client);
+  GstClockTime next = CLIENT_NEXT_FRAME_TIME (client);
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+
+  if (interval == 0 || !GST_CLOCK_TIME_IS_VALID (pts))
+    return FALSE;
+
+  if (pts < next)
+    return TRUE;
+
+  /* stay on the grid so capture jitter doesn't lower the rate, but don't try
+   * to catch up after a gap in the stream */
+  if (pts >= next + interval)
+    next = pts;
+  CLIENT_NEXT_FRAME_TIME (client) = next + interval;
+
+  return FALSE;
+}
+
+/* time the buffer at @pos in the queue has been queued for at @now */
+static inline GstClockTime
+gst_multi_handle_sink_buffer_age (GstMultiHandleSink * sink, gint pos,
+    GstClockTime now)
+{
+  GstClockTime queued =
+      g_array_index (sink->bufqueue_times, GstClockTime, pos);
+
+  return now > queued ? now - queued : 0;
+}
+
+/* max-frame-age check, to be called by the subclass before it sends the
+ * buffer at the position of @client, with a coarse time it has already read
+ * for this write. If that buffer is too old the client is moved to the newest
+ * buffer, or to no buffer at all if that one is stale too. Returns TRUE if
+ * the client was moved. Must be called with the clients lock held. */
+gboolean
+gst_multi_handle_sink_client_drop_stale (GstMultiHandleSink * sink,
+    GstMultiHandleClient * client, GstClockTime now)
+{
+  gint pos = CLIENT_BUFPOS (client);
+  gint newpos;
+
+  if (sink->max_frame_age == 0 || pos < 0)
+    return FALSE;
+
+  if (gst_multi_handle_sink_buffer_age (sink, pos, now) <= sink->max_frame_age)
+    return FALSE;
+
+  newpos = -1;
+  if (pos > 0 &&
+      gst_multi_handle_sink_buffer_age (sink, 0, now) <= sink->max_frame_age)
+    newpos = 0;
+
+  GST_INFO_OBJECT (sink, "%s client %p skipping %d stale buffers",
+      client->debug, client, pos - newpos);
+  client->buffers_stale += pos - newpos;
+  client->discont = TRUE;
+  CLIENT_BUFPOS (client) = newpos;
+
+  return TRUE;
+}
+
+/* moving average over roughly the last 8 samples */
+#define EWMA(avg, sample) (((avg) * 7 + (sample)) / 8)
+
+/* adaptive-limits: from @delay, the time the buffer @client just took spent
+ * in the queue since it arrived, work out how many buffers it may fall behind
+ * before it needs recovering. This is measured against frame arrival so how
+ * long the writes take doesn't come into it. Our limits are in buffers so
+ * everything is relative to the average frame interval. */
+static void
+gst_multi_handle_sink_client_update_limits (GstMultiHandleSink * sink,
+    GstMultiHandleClient * client, GstClockTime delay)
+{
+  GstClockTime deviation;
+  guint64 soft, hard;
+
+  if (!GST_CLOCK_TIME_IS_VALID (client->consume_delay))
+    client->consume_delay = delay;
+  deviation = delay > client->consume_delay ?
+      delay - client->consume_delay : client->consume_delay - delay;
+  client->consume_delay = EWMA (client->consume_delay, delay);
+  client->consume_jitter = EWMA (client->consume_jitter, deviation);
+
+  if (sink->frame_interval == 0)
+    return;
+
+  /* enough for the buffers that usually arrive while one waits for the
+   * client, and some more for the occasional outlier before we give up on
+   * it */
+  soft = (client->consume_delay + 2 * client->consume_jitter +
+      sink->frame_interval / 2) / sink->frame_interval;
+  soft = MAX (soft, 1);
+  hard = soft + 1 + 4 * client->consume_jitter / sink->frame_interval;
+
+  CLIENT_WANTED_SOFT_MAX (client) = MIN (soft, G_MAXINT);
+  CLIENT_WANTED_MAX (client) = MIN (hard, G_MAXINT);
+}
+
+/* the limits that apply to the client in @slot given the global limits in
+ * buffers, -1 means no limit */
+static inline void
+gst_multi_handle_sink_client_limits (GstMultiHandleSink * sink, guint slot,
+    gint soft_max_buffers, gint max_buffers, gint * soft_max, gint * max)
+{
+  *soft_max = soft_max_buffers;
+  *max = max_buffers;
+
+  if (!sink->adaptive_limits || sink->table.wanted_soft_max[slot] == 0)
+    return;
+
+  if (soft_max_buffers > 0)
+    *soft_max = MIN (sink->table.wanted_soft_max[slot], soft_max_buffers);
+  if (max_buffers > 0)
+    *max = MIN (sink->table.wanted_max[slot], max_buffers);
+}
+
+static guint
+latency_bucket (GstClockTime latency)
+{
+  guint64 ms = latency / GST_MSECOND;
+  guint bucket = 0;
+
+  while (ms > 0 && bucket < GST_CLIENT_LATENCY_BUCKETS - 1) {
+    ms >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+/* to be called by the subclass when it takes the buffer at @pos in the queue
+ * to write it to @client, with a coarse time it has already read for this
+ * write. The latency is measured from the time queue_buffer read for the
+ * buffer so this costs no clock reads. Must be called with the clients lock
+ * held. */
+void
+gst_multi_handle_sink_client_take_buffer (GstMultiHandleSink * sink,
+    GstMultiHandleClient * client, gint pos, GstClockTime now)
+{
+  GstClockTime queued, latency;
+
+  queued = g_array_index (sink->bufqueue_times, GstClockTime, pos);
+  latency = now > queued ? now - queued : 0;
+
+  if (sink->adaptive_limits)
+    gst_multi_handle_sink_client_update_limits (sink, client, latency);
+
+  client->send_latency[latency_bucket (latency)]++;
+
+  sink->priority_stats[client->priority].buffers++;
+  sink->priority_stats[client->priority].total_latency += latency;
+  sink->priority_stats[client->priority].max_latency =
+      MAX (sink->priority_stats[client->priority].max_latency, latency);
+}
+
+static GstStructure *
+gst_multi_handle_sink_get_priority_stats (GstMultiHandleSink * sink)
+{
+  static const gchar *names[GST_CLIENT_PRIORITY_N] = { "high", "low" };
+  GstStructure *s;
+  guint i;
+
+  s = gst_structure_new_empty ("multihandlesink-priority-stats");
+
+  CLIENTS_LOCK (sink);
+  for (i = 0; i < GST_CLIENT_PRIORITY_N; i++) {
+    gchar *buffers = g_strdup_printf ("%s-buffers", names[i]);
+    gchar *mean = g_strdup_printf ("%s-mean-latency", names[i]);
+    gchar *max = g_strdup_printf ("%s-max-latency", names[i]);
+    guint64 n = sink->priority_stats[i].buffers;
+
+    gst_structure_set (s,
+        buffers, G_TYPE_UINT64, n,
+        mean, G_TYPE_UINT64, n ? sink->priority_stats[i].total_latency / n : 0,
+        max, G_TYPE_UINT64, sink->priority_stats[i].max_latency, NULL);
+    g_free (buffers);
+    g_free (mean);
+    g_free (max);
+  }
+  CLIENTS_UNLOCK (sink);
+
+  return s;
+}
+
+static void
+gst_multi_handle_sink_add_internal (GstMultiHandleSink * sink,
     GstMultiSinkHandle handle, GstSyncMethod sync_method, GstFormat min_format,
-    guint64 min_value, GstFormat max_format, guint64 max_value)
+    guint64 min_value, GstFormat max_format, guint64 max_value,
+    const GstStructure * options)
 {
   GstMultiHandleClient *mhclient;
-  GList *clink;
   GstMultiHandleSink *mhsink = GST_MULTI_HANDLE_SINK (sink);
   gchar debug[30];
   GstMultiHandleSinkClass *mhsinkclass =
@@ -670,9 +1293,8 @@ gst_multi_handle_sink_add_full (GstMultiHandleSink * sink,
   CLIENTS_LOCK (sink);
 
   /* check the hash to find a duplicate handle */
-  clink = g_hash_table_lookup (mhsink->handle_hash,
-      mhsinkclass->handle_hash_key (handle));
-  if (clink != NULL)
+  if (g_hash_table_lookup (mhsink->handle_hash,
+          mhsinkclass->handle_hash_key (handle)) != NULL)
     goto duplicate;
 
   /* We do not take ownership of @handle in this function, but we can't take a
@@ -682,17 +1304,29 @@ gst_multi_handle_sink_add_full (GstMultiHandleSink * sink,
   mhclient = mhsinkclass->new_client (mhsink, handle, sync_method);
 
   /* we can add the handle now */
-  clink = mhsink->clients = g_list_prepend (mhsink->clients, mhclient);
+  gst_multi_handle_client_table_insert (&mhsink->table, mhclient,
+      mhsink->timeout);
   g_hash_table_insert (mhsink->handle_hash,
-      mhsinkclass->handle_hash_key (mhclient->handle), clink);
-  mhsink->clients_cookie++;
-
+      mhsinkclass->handle_hash_key (mhclient->handle), mhclient);
 
   mhclient->burst_min_format = min_format;
   mhclient->burst_min_value = min_value;
   mhclient->burst_max_format = max_format;
   mhclient->burst_max_value = max_value;
 
+  /* before we release the lock, so the first buffer already honours them */
+  gst_multi_handle_sink_client_set_options (mhsink, mhclient, options);
+
+  /* start with the newest buffers we already have instead of waiting for the
+   * next one */
+  if (mhclient->sync_method == GST_SYNC_METHOD_LATEST &&
+      mhsink->burst_latest > 0 && mhsink->bufqueue->len > 0) {
+    CLIENT_BUFPOS (mhclient) =
+        MIN (mhsink->burst_latest, (gint) mhsink->bufqueue->len) - 1;
+    GST_DEBUG_OBJECT (sink, "%s bursting %d queued buffers", debug,
+        CLIENT_BUFPOS (mhclient) + 1);
+  }
+
   if (mhsinkclass->hash_changed)
     mhsinkclass->hash_changed (mhsink);
 
@@ -721,6 +1355,25 @@ duplicate:
   }
 }
 
+void
+gst_multi_handle_sink_add_full (GstMultiHandleSink * sink,
+    GstMultiSinkHandle handle, GstSyncMethod sync_method, GstFormat min_format,
+    guint64 min_value, GstFormat max_format, guint64 max_value)
+{
+  gst_multi_handle_sink_add_internal (sink, handle, sync_method, min_format,
+      min_value, max_format, max_value, NULL);
+}
+
+/* "add-with-options" signal implementation */
+void
+gst_multi_handle_sink_add_with_options (GstMultiHandleSink * sink,
+    GstMultiSinkHandle handle, const GstStructure * options)
+{
+  gst_multi_handle_sink_add_internal (sink, handle, sink->def_sync_method,
+      sink->def_burst_format, sink->def_burst_value, sink->def_burst_format,
+      -1, options);
+}
+
 /* "add" signal implementation */
 void
 gst_multi_handle_sink_add (GstMultiHandleSink * sink, GstMultiSinkHandle handle)
@@ -735,7 +1388,7 @@ void
 gst_multi_handle_sink_remove (GstMultiHandleSink * sink,
     GstMultiSinkHandle handle)
 {
-  GList *clink;
+  GstMultiHandleClient *mhclient;
   GstMultiHandleSink *mhsink = GST_MULTI_HANDLE_SINK (sink);
   GstMultiHandleSinkClass *mhsinkclass =
       GST_MULTI_HANDLE_SINK_GET_CLASS (mhsink);
@@ -746,21 +1399,20 @@ gst_multi_handle_sink_remove (GstMultiHandleSink * sink,
   GST_DEBUG_OBJECT (sink, "%s removing client", debug);
 
   CLIENTS_LOCK (sink);
-  clink = g_hash_table_lookup (mhsink->handle_hash,
+  mhclient = g_hash_table_lookup (mhsink->handle_hash,
       mhsinkclass->handle_hash_key (handle));
-  if (clink != NULL) {
-    GstMultiHandleClient *mhclient = (GstMultiHandleClient *) clink->data;
+  if (mhclient != NULL) {
 
-    if (mhclient->status != GST_CLIENT_STATUS_OK) {
+    if (CLIENT_STATUS (mhclient) != GST_CLIENT_STATUS_OK) {
       GST_INFO_OBJECT (sink,
           "%s Client already disconnecting with status %d",
-          debug, mhclient->status);
+          debug, CLIENT_STATUS (mhclient));
       goto done;
     }
 
-    mhclient->status = GST_CLIENT_STATUS_REMOVED;
-    gst_multi_handle_sink_remove_client_link (GST_MULTI_HANDLE_SINK (sink),
-        clink);
+    CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_REMOVED;
+    gst_multi_handle_sink_remove_client (GST_MULTI_HANDLE_SINK (sink),
+        mhclient);
     if (mhsinkclass->hash_changed)
       mhsinkclass->hash_changed (mhsink);
   } else {
@@ -776,7 +1428,7 @@ void
 gst_multi_handle_sink_remove_flush (GstMultiHandleSink * sink,
     GstMultiSinkHandle handle)
 {
-  GList *clink;
+  GstMultiHandleClient *mhclient;
   GstMultiHandleSink *mhsink = GST_MULTI_HANDLE_SINK (sink);
   GstMultiHandleSinkClass *mhsinkclass =
       GST_MULTI_HANDLE_SINK_GET_CLASS (mhsink);
@@ -787,25 +1439,24 @@ gst_multi_handle_sink_remove_flush (GstMultiHandleSink * sink,
   GST_DEBUG_OBJECT (sink, "%s flushing client", debug);
 
   CLIENTS_LOCK (sink);
-  clink = g_hash_table_lookup (mhsink->handle_hash,
+  mhclient = g_hash_table_lookup (mhsink->handle_hash,
       mhsinkclass->handle_hash_key (handle));
-  if (clink != NULL) {
-    GstMultiHandleClient *mhclient = (GstMultiHandleClient *) clink->data;
+  if (mhclient != NULL) {
 
-    if (mhclient->status != GST_CLIENT_STATUS_OK) {
+    if (CLIENT_STATUS (mhclient) != GST_CLIENT_STATUS_OK) {
       GST_INFO_OBJECT (sink,
           "%s Client already disconnecting with status %d",
-          mhclient->debug, mhclient->status);
+          mhclient->debug, CLIENT_STATUS (mhclient));
       goto done;
     }
 
     /* take the position of the client as the number of buffers left to flush.
      * If the client was at position -1, we flush 0 buffers, 0 == flush 1
      * buffer, etc... */
-    mhclient->flushcount = mhclient->bufpos + 1;
+    mhclient->flushcount = CLIENT_BUFPOS (mhclient) + 1;
     /* mark client as flushing. We can not remove the client right away because
      * it might have some buffers to flush in the ->sending queue. */
-    mhclient->status = GST_CLIENT_STATUS_FLUSHING;
+    CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_FLUSHING;
   } else {
     GST_WARNING_OBJECT (sink, "%s no client with this handle found!", debug);
   }
@@ -818,31 +1469,23 @@ done:
 static void
 gst_multi_handle_sink_clear (GstMultiHandleSink * mhsink)
 {
-  GList *clients, *next;
-  guint32 cookie;
+  guint slot;
   GstMultiHandleSinkClass *mhsinkclass =
       GST_MULTI_HANDLE_SINK_GET_CLASS (mhsink);
 
   GST_DEBUG_OBJECT (mhsink, "clearing all clients");
 
   CLIENTS_LOCK (mhsink);
-restart:
-  cookie = mhsink->clients_cookie;
-  for (clients = mhsink->clients; clients; clients = next) {
-    GstMultiHandleClient *mhclient;
+  /* slots are stable, so clients added or removed while the lock is released
+   * in remove_client() don't upset the iteration */
+  for (slot = 0; slot < mhsink->table.end; slot++) {
+    GstMultiHandleClient *mhclient = mhsink->table.client[slot];
 
-    if (cookie != mhsink->clients_cookie) {
-      GST_DEBUG_OBJECT (mhsink, "cookie changed while removing all clients");
-      goto restart;
-    }
-
-    mhclient = (GstMultiHandleClient *) clients->data;
-    next = g_list_next (clients);
+    if (mhclient == NULL)
+      continue;
 
-    mhclient->status = GST_CLIENT_STATUS_REMOVED;
-    /* the next call changes the list, which is why we iterate
-     * with a temporary next pointer */
-    gst_multi_handle_sink_remove_client_link (mhsink, clients);
+    CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_REMOVED;
+    gst_multi_handle_sink_remove_client (mhsink, mhclient);
   }
   if (mhsinkclass->hash_changed)
     mhsinkclass->hash_changed (mhsink);
@@ -859,7 +1502,6 @@ gst_multi_handle_sink_get_stats (GstMultiHandleSink * sink,
 {
   GstMultiHandleClient *client;
   GstStructure *result = NULL;
-  GList *clink;
   GstMultiHandleSink *mhsink = GST_MULTI_HANDLE_SINK (sink);
   GstMultiHandleSinkClass *mhsinkclass =
       GST_MULTI_HANDLE_SINK_GET_CLASS (mhsink);
@@ -868,15 +1510,15 @@ gst_multi_handle_sink_get_stats (GstMultiHandleSink * sink,
   mhsinkclass->handle_debug (handle, debug);
 
   CLIENTS_LOCK (sink);
-  clink = g_hash_table_lookup (mhsink->handle_hash,
+  client = g_hash_table_lookup (mhsink->handle_hash,
       mhsinkclass->handle_hash_key (handle));
-  if (clink == NULL)
-    goto noclient;
-
-  client = clink->data;
   if (client != NULL) {
     GstMultiHandleClient *mhclient = (GstMultiHandleClient *) client;
-    guint64 interval;
+    guint64 interval, last_activity;
+    gint soft_max, max;
+    GValue histogram = G_VALUE_INIT;
+    GValue bucket = G_VALUE_INIT;
+    guint i;
 
     result = gst_structure_new_empty ("multihandlesink-stats");
 
@@ -890,18 +1532,49 @@ gst_multi_handle_sink_get_stats (GstMultiHandleSink * sink,
       interval = mhclient->disconnect_time - mhclient->connect_time;
     }
 
+    /* activity is tracked on the monotonic clock, report it as wall clock
+     * time like the other timestamps */
+    last_activity = g_get_real_time () * GST_USECOND -
+        (gst_multi_handle_sink_coarse_now () -
+        CLIENT_LAST_ACTIVITY_TIME (mhclient));
+
+    gst_multi_handle_sink_client_limits (mhsink, mhclient->slot,
+        mhsink->units_soft_max > 0 ?
+        get_buffers_max (mhsink, mhsink->units_soft_max) : -1,
+        mhsink->units_max > 0 ?
+        get_buffers_max (mhsink, mhsink->units_max) : -1,
+        &soft_max, &max);
+
     gst_structure_set (result,
         "bytes-sent", G_TYPE_UINT64, mhclient->bytes_sent,
         "connect-time", G_TYPE_UINT64, mhclient->connect_time,
         "disconnect-time", G_TYPE_UINT64, mhclient->disconnect_time,
         "connect-duration", G_TYPE_UINT64, interval,
-        "last-activitity-time", G_TYPE_UINT64, mhclient->last_activity_time,
-        "buffers-dropped", G_TYPE_UINT64, mhclient->dropped_buffers,
+        "last-activitity-time", G_TYPE_UINT64, last_activity,
+        "buffers-dropped", G_TYPE_UINT64, CLIENT_DROPPED_BUFFERS (mhclient),
+        "buffers-stale", G_TYPE_UINT64, mhclient->buffers_stale,
+        "buffers-soft-max", G_TYPE_INT, soft_max,
+        "buffers-max", G_TYPE_INT, max,
+        "consumption-delay", G_TYPE_UINT64,
+        GST_CLOCK_TIME_IS_VALID (mhclient->consume_delay) ?
+        mhclient->consume_delay : 0,
+        "consumption-jitter", G_TYPE_UINT64, mhclient->consume_jitter,
+        "buffers-queued", G_TYPE_INT, CLIENT_BUFPOS (mhclient) + 1,
+        "credit", G_TYPE_INT, mhclient->credit,
+        "credit-granted", G_TYPE_UINT64, mhclient->credit_granted,
         "first-buffer-ts", G_TYPE_UINT64, mhclient->first_buffer_ts,
         "last-buffer-ts", G_TYPE_UINT64, mhclient->last_buffer_ts, NULL);
+
+    g_value_init (&histogram, GST_TYPE_ARRAY);
+    g_value_init (&bucket, G_TYPE_UINT64);
+    for (i = 0; i < GST_CLIENT_LATENCY_BUCKETS; i++) {
+      g_value_set_uint64 (&bucket, mhclient->send_latency[i]);
+      gst_value_array_append_value (&histogram, &bucket);
+    }
+    g_value_unset (&bucket);
+    gst_structure_take_value (result, "send-latency-histogram", &histogram);
   }
 
-noclient:
   CLIENTS_UNLOCK (sink);
 
   /* python doesn't like a NULL pointer yet */
@@ -919,11 +1592,10 @@ noclient:
  * close the fd itself.
  */
 void
-gst_multi_handle_sink_remove_client_link (GstMultiHandleSink * sink,
-    GList * link)
+gst_multi_handle_sink_remove_client (GstMultiHandleSink * sink,
+    GstMultiHandleClient * mhclient)
 {
   GTimeVal now;
-  GstMultiHandleClient *mhclient = (GstMultiHandleClient *) link->data;
   GstMultiHandleSinkClass *mhsinkclass = GST_MULTI_HANDLE_SINK_GET_CLASS (sink);
 
   if (mhclient->currently_removing) {
@@ -935,7 +1607,7 @@ gst_multi_handle_sink_remove_client_link (GstMultiHandleSink * sink,
   }
 
   /* FIXME: if we keep track of ip we can log it here and signal */
-  switch (mhclient->status) {
+  switch (CLIENT_STATUS (mhclient)) {
     case GST_CLIENT_STATUS_OK:
       GST_WARNING_OBJECT (sink, "%s removing client %p for no reason",
           mhclient->debug, mhclient);
@@ -962,7 +1634,7 @@ gst_multi_handle_sink_remove_client_link (GstMultiHandleSink * sink,
     default:
       GST_WARNING_OBJECT (sink,
           "%s removing client %p with invalid reason %d", mhclient->debug,
-          mhclient, mhclient->status);
+          mhclient, CLIENT_STATUS (mhclient));
       break;
   }
 
@@ -984,7 +1656,8 @@ gst_multi_handle_sink_remove_client_link (GstMultiHandleSink * sink,
    * might query some properties */
   CLIENTS_UNLOCK (sink);
 
-  mhsinkclass->emit_client_removed (sink, mhclient->handle, mhclient->status);
+  mhsinkclass->emit_client_removed (sink, mhclient->handle,
+      CLIENT_STATUS (mhclient));
 
   /* lock again before we remove the client completely */
   CLIENTS_LOCK (sink);
@@ -996,13 +1669,8 @@ gst_multi_handle_sink_remove_client_link (GstMultiHandleSink * sink,
     GST_WARNING_OBJECT (sink,
         "%s error removing client %p from hash", mhclient->debug, mhclient);
   }
-  /* after releasing the lock above, the link could be invalid, more
-   * precisely, the next and prev pointers could point to invalid list
-   * links. One optimisation could be to add a cookie to the linked list
-   * and take a shortcut when it did not change between unlocking and locking
-   * our mutex. For now we just walk the list again. */
-  sink->clients = g_list_remove (sink->clients, mhclient);
-  sink->clients_cookie++;
+  /* the slot stayed ours while the lock was released above, free it now */
+  gst_multi_handle_client_table_remove (&sink->table, mhclient);
 
   if (mhsinkclass->removed)
     mhsinkclass->removed (sink, mhclient->handle);
@@ -1426,7 +2094,7 @@ gst_multi_handle_sink_new_client_position (GstMultiHandleSink * sink,
   switch (client->sync_method) {
     case GST_SYNC_METHOD_LATEST:
       /* no syncing, we are happy with whatever the client is going to get */
-      result = client->bufpos;
+      result = CLIENT_BUFPOS (client);
       GST_DEBUG_OBJECT (sink,
           "%s SYNC_METHOD_LATEST, position %d", client->debug, result);
       break;
@@ -1436,9 +2104,9 @@ gst_multi_handle_sink_new_client_position (GstMultiHandleSink * sink,
        * is a sync point, we can proceed, otherwise we need to keep waiting */
       GST_LOG_OBJECT (sink,
           "%s new client, bufpos %d, waiting for keyframe",
-          client->debug, client->bufpos);
+          client->debug, CLIENT_BUFPOS (client));
 
-      result = find_prev_syncframe (sink, client->bufpos);
+      result = find_prev_syncframe (sink, CLIENT_BUFPOS (client));
       if (result != -1) {
         GST_DEBUG_OBJECT (sink,
             "%s SYNC_METHOD_NEXT_KEYFRAME: result %d", client->debug, result);
@@ -1450,7 +2118,7 @@ gst_multi_handle_sink_new_client_position (GstMultiHandleSink * sink,
       GST_LOG_OBJECT (sink,
           "%s new client, skipping buffer(s), no syncpoint found",
           client->debug);
-      client->bufpos = -1;
+      CLIENT_BUFPOS (client) = -1;
       break;
     }
     case GST_SYNC_METHOD_LATEST_KEYFRAME:
@@ -1473,7 +2141,7 @@ gst_multi_handle_sink_new_client_position (GstMultiHandleSink * sink,
           "%s SYNC_METHOD_LATEST_KEYFRAME: no keyframe found, "
           "switching to SYNC_METHOD_NEXT_KEYFRAME", client->debug);
       /* throw client to the waiting state */
-      client->bufpos = -1;
+      CLIENT_BUFPOS (client) = -1;
       /* and make client sync to next keyframe */
       client->sync_method = GST_SYNC_METHOD_NEXT_KEYFRAME;
       break;
@@ -1548,7 +2216,7 @@ gst_multi_handle_sink_new_client_position (GstMultiHandleSink * sink,
           "no prev keyframe found in BURST_KEYFRAME sync mode, waiting for next");
 
       /* throw client to the waiting state */
-      client->bufpos = -1;
+      CLIENT_BUFPOS (client) = -1;
       /* and make client sync to next keyframe */
       client->sync_method = GST_SYNC_METHOD_NEXT_KEYFRAME;
       result = -1;
@@ -1595,7 +2263,7 @@ gst_multi_handle_sink_new_client_position (GstMultiHandleSink * sink,
     }
     default:
       g_warning ("unknown sync method %d", client->sync_method);
-      result = client->bufpos;
+      result = CLIENT_BUFPOS (client);
       break;
   }
   return result;
@@ -1613,13 +2281,13 @@ gst_multi_handle_sink_recover_client (GstMultiHandleSink * sink,
 
   GST_WARNING_OBJECT (sink,
       "%s client %p is lagging at %d, recover using policy %d",
-      client->debug, client, client->bufpos, sink->recover_policy);
+      client->debug, client, CLIENT_BUFPOS (client), sink->recover_policy);
 
   switch (sink->recover_policy) {
     case GST_RECOVER_POLICY_NONE:
       /* do nothing, client will catch up or get kicked out when it reaches
        * the hard max */
-      newbufpos = client->bufpos;
+      newbufpos = CLIENT_BUFPOS (client);
       break;
     case GST_RECOVER_POLICY_RESYNC_LATEST:
       /* move to beginning of queue */
@@ -1628,6 +2296,8 @@ gst_multi_handle_sink_recover_client (GstMultiHandleSink * sink,
     case GST_RECOVER_POLICY_RESYNC_SOFT_LIMIT:
       /* move to beginning of soft max */
       newbufpos = get_buffers_max (sink, sink->units_soft_max);
+      if (sink->adaptive_limits && CLIENT_WANTED_SOFT_MAX (client) > 0)
+        newbufpos = MIN (newbufpos, CLIENT_WANTED_SOFT_MAX (client));
       break;
     case GST_RECOVER_POLICY_RESYNC_KEYFRAME:
       /* find keyframe in buffers, we search backwards to find the
@@ -1676,15 +2346,14 @@ static void
 gst_multi_handle_sink_queue_buffer (GstMultiHandleSink * mhsink,
     GstBuffer * buffer)
 {
-  GList *clients, *next;
+  GstMultiHandleClientTable *table = &mhsink->table;
+  guint slot;
   gint queuelen;
   gboolean hash_changed = FALSE;
   gint max_buffer_usage;
   gint i;
-  GTimeVal nowtv;
-  GstClockTime now;
+  GstClockTime now, pts;
   gint max_buffers, soft_max_buffers;
-  guint cookie;
   GstMultiHandleSink *sink = GST_MULTI_HANDLE_SINK (mhsink);
   GstMultiHandleSinkClass *mhsinkclass =
       GST_MULTI_HANDLE_SINK_GET_CLASS (mhsink);
@@ -1706,70 +2375,127 @@ gst_multi_handle_sink_queue_buffer (GstMultiHandleSink * mhsink,
   GST_LOG_OBJECT (sink, "Using max %d, softmax %d", max_buffers,
       soft_max_buffers);
 
-  /* then loop over the clients and update the positions */
+  /* the one clock read for this buffer */
+  now = gst_multi_handle_sink_coarse_now ();
+  g_array_prepend_val (mhsink->bufqueue_times, now);
+
+  /* get rid of the clients that timed out first */
+  if (gst_multi_handle_sink_expire_clients (mhsink, now))
+    hash_changed = TRUE;
+
+  /* then loop over the clients and update the positions. We only touch the
+   * cold client state when something happens to a client. Slots are stable so
+   * we don't need to restart when the lock is released to remove a client,
+   * but the table arrays may be reallocated so they are not cached. */
   max_buffer_usage = 0;
+  pts = GST_BUFFER_PTS (buffer);
 
-restart:
-  cookie = mhsink->clients_cookie;
-  for (clients = mhsink->clients; clients; clients = next) {
-    GstMultiHandleClient *mhclient = clients->data;
+  /* the adaptive limits are in buffers, so we need to know the frame rate */
+  if (GST_CLOCK_TIME_IS_VALID (pts) &&
+      GST_CLOCK_TIME_IS_VALID (mhsink->last_pts) && pts > mhsink->last_pts) {
+    GstClockTime frame_interval = pts - mhsink->last_pts;
 
-    g_get_current_time (&nowtv);
-    now = GST_TIMEVAL_TO_TIME (nowtv);
+    mhsink->frame_interval = mhsink->frame_interval ?
+        EWMA (mhsink->frame_interval, frame_interval) : frame_interval;
+  }
+  mhsink->last_pts = pts;
 
-    if (cookie != mhsink->clients_cookie) {
-      GST_DEBUG_OBJECT (sink, "Clients cookie outdated, restarting");
-      goto restart;
-    }
+  for (slot = 0; slot < table->end; slot++) {
+    GstMultiHandleClient *mhclient;
+    gint bufpos;
+    gint client_soft_max, client_max;
+
+    if (table->client[slot] == NULL)
+      continue;
 
-    next = g_list_next (clients);
+    /* an idle client that doesn't want this buffer because of its
+     * max-framerate doesn't even get to see it, so it costs no wakeup */
+    if (table->bufpos[slot] == -1 && !table->new_connection[slot]
+        && pts < table->next_frame_time[slot])
+      continue;
 
-    mhclient->bufpos++;
+    bufpos = ++table->bufpos[slot];
     GST_LOG_OBJECT (sink, "%s client %p at position %d",
-        mhclient->debug, mhclient, mhclient->bufpos);
+        table->client[slot]->debug, table->client[slot], bufpos);
+    gst_multi_handle_sink_client_limits (mhsink, slot, soft_max_buffers,
+        max_buffers, &client_soft_max, &client_max);
+
     /* check soft max if needed, recover client */
-    if (soft_max_buffers > 0 && mhclient->bufpos >= soft_max_buffers) {
+    if (client_soft_max > 0 && bufpos >= client_soft_max) {
       gint newpos;
 
+      mhclient = table->client[slot];
       newpos = gst_multi_handle_sink_recover_client (mhsink, mhclient);
-      if (newpos != mhclient->bufpos) {
-        mhclient->dropped_buffers += mhclient->bufpos - newpos;
-        mhclient->bufpos = newpos;
+      if (newpos != bufpos) {
+        table->dropped_buffers[slot] += bufpos - newpos;
+        table->bufpos[slot] = bufpos = newpos;
         mhclient->discont = TRUE;
         GST_INFO_OBJECT (sink, "%s client %p position reset to %d",
-            mhclient->debug, mhclient, mhclient->bufpos);
+            mhclient->debug, mhclient, bufpos);
       } else {
         GST_INFO_OBJECT (sink,
             "%s client %p not recovering position", mhclient->debug, mhclient);
       }
     }
-    /* check hard max and timeout, remove client */
-    if ((max_buffers > 0 && mhclient->bufpos >= max_buffers) ||
-        (mhsink->timeout > 0
-            && now - mhclient->last_activity_time > mhsink->timeout)) {
+    /* check hard max, remove client */
+    if (client_max > 0 && bufpos >= client_max) {
+      mhclient = table->client[slot];
       /* remove client */
       GST_WARNING_OBJECT (sink, "%s client %p is too slow, removing",
           mhclient->debug, mhclient);
       /* remove the client, the handle set will be cleared and the select thread
        * will be signaled */
-      mhclient->status = GST_CLIENT_STATUS_SLOW;
+      table->status[slot] = GST_CLIENT_STATUS_SLOW;
       /* set client to invalid position while being removed */
-      mhclient->bufpos = -1;
-      gst_multi_handle_sink_remove_client_link (mhsink, clients);
+      table->bufpos[slot] = -1;
+      gst_multi_handle_sink_remove_client (mhsink, mhclient);
       hash_changed = TRUE;
       continue;
-    } else if (mhclient->bufpos == 0 || mhclient->new_connection) {
-      /* can send data to this client now. need to signal the select thread that
-       * the handle_set changed */
-      mhsinkclass->hash_adding (mhsink, mhclient);
-      hash_changed = TRUE;
+    } else if (bufpos == 0 || table->new_connection[slot]) {
+      gboolean pending = TRUE;
+
+      mhclient = table->client[slot];
+      if (mhclient->priority == GST_CLIENT_PRIORITY_LOW) {
+        /* only woken once all the high priority clients had their turn */
+        g_array_append_val (mhsink->deferred, slot);
+        pending = FALSE;
+      } else if (mhsink->inline_send && mhsinkclass->client_write &&
+          mhclient->credit != 0) {
+        /* the client was waiting for this buffer, try to write it right away
+         * and only involve the sender thread if that would block */
+        if (!mhsinkclass->client_write (mhsink, mhclient)) {
+          gst_multi_handle_sink_remove_client (mhsink, mhclient);
+          hash_changed = TRUE;
+          continue;
+        }
+        bufpos = table->bufpos[slot];
+        pending = bufpos != -1 || mhclient->sending != NULL;
+      }
+      if (pending) {
+        /* can send data to this client now. need to signal the select thread
+         * that the handle_set changed */
+        mhsinkclass->hash_adding (mhsink, mhclient);
+        hash_changed = TRUE;
+      }
     }
     /* keep track of maximum buffer usage */
-    if (mhclient->bufpos > max_buffer_usage) {
-      max_buffer_usage = mhclient->bufpos;
+    if (bufpos > max_buffer_usage) {
+      max_buffer_usage = bufpos;
     }
   }
 
+  /* low priority clients are never written from here but left to the sender
+   * thread, which only serves them when no high priority client is writable.
+   * The slot may have been freed by a removal in the meantime. */
+  for (i = 0; i < mhsink->deferred->len; i++) {
+    slot = g_array_index (mhsink->deferred, guint, i);
+    if (table->client[slot] == NULL)
+      continue;
+    mhsinkclass->hash_adding (mhsink, table->client[slot]);
+    hash_changed = TRUE;
+  }
+  g_array_set_size (mhsink->deferred, 0);
+
   /* make sure we respect bytes-min, buffers-min and time-min when they are set */
   {
     gint usage, max;
@@ -1790,6 +2516,9 @@ restart:
     GST_LOG_OBJECT (sink, "extended queue to %d", max_buffer_usage);
   }
 
+  /* keep what we want to burst to new clients */
+  max_buffer_usage = MAX (max_buffer_usage, mhsink->burst_latest - 1);
+
   /* now look for sync points and make sure there is at least one
    * sync point in the queue. We only do this if the LATEST_KEYFRAME or 
    * BURST_KEYFRAME mode is selected */
@@ -1830,6 +2559,7 @@ restart:
     queuelen--;
     old = g_array_index (mhsink->bufqueue, GstBuffer *, i);
     mhsink->bufqueue = g_array_remove_index (mhsink->bufqueue, i);
+    g_array_remove_index (mhsink->bufqueue_times, i);
 
     /* unref tail buffer */
     gst_buffer_unref (old);
@@ -1988,7 +2718,11 @@ gst_multi_handle_sink_set_property (GObject * object, guint prop_id,
       multihandlesink->recover_policy = g_value_get_enum (value);
       break;
     case PROP_TIMEOUT:
-      multihandlesink->timeout = g_value_get_uint64 (value);
+      gst_multi_handle_sink_set_timeout (multihandlesink,
+          g_value_get_uint64 (value));
+      break;
+    case PROP_MAX_FRAME_AGE:
+      multihandlesink->max_frame_age = g_value_get_uint64 (value);
       break;
     case PROP_SYNC_METHOD:
       multihandlesink->def_sync_method = g_value_get_enum (value);
@@ -2007,6 +2741,15 @@ gst_multi_handle_sink_set_property (GObject * object, guint prop_id,
     case PROP_RESEND_STREAMHEADER:
       multihandlesink->resend_streamheader = g_value_get_boolean (value);
       break;
+    case PROP_INLINE_SEND:
+      multihandlesink->inline_send = g_value_get_boolean (value);
+      break;
+    case PROP_BURST_LATEST:
+      multihandlesink->burst_latest = g_value_get_int (value);
+      break;
+    case PROP_ADAPTIVE_LIMITS:
+      multihandlesink->adaptive_limits = g_value_get_boolean (value);
+      break;
 
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -2062,6 +2805,9 @@ gst_multi_handle_sink_get_property (GObject * object, guint prop_id,
     case PROP_TIMEOUT:
       g_value_set_uint64 (value, multihandlesink->timeout);
       break;
+    case PROP_MAX_FRAME_AGE:
+      g_value_set_uint64 (value, multihandlesink->max_frame_age);
+      break;
     case PROP_SYNC_METHOD:
       g_value_set_enum (value, multihandlesink->def_sync_method);
       break;
@@ -2083,6 +2829,19 @@ gst_multi_handle_sink_get_property (GObject * object, guint prop_id,
     case PROP_RESEND_STREAMHEADER:
       g_value_set_boolean (value, multihandlesink->resend_streamheader);
       break;
+    case PROP_INLINE_SEND:
+      g_value_set_boolean (value, multihandlesink->inline_send);
+      break;
+    case PROP_BURST_LATEST:
+      g_value_set_int (value, multihandlesink->burst_latest);
+      break;
+    case PROP_ADAPTIVE_LIMITS:
+      g_value_set_boolean (value, multihandlesink->adaptive_limits);
+      break;
+    case PROP_PRIORITY_STATS:
+      g_value_take_boxed (value,
+          gst_multi_handle_sink_get_priority_stats (multihandlesink));
+      break;
     case PROP_NUM_HANDLES:
       g_value_set_uint (value,
           g_hash_table_size (multihandlesink->handle_hash));
@@ -2112,6 +2871,9 @@ gst_multi_handle_sink_start (GstBaseSink * bsink)
   mhsink->streamheader = NULL;
   mhsink->bytes_to_serve = 0;
   mhsink->bytes_served = 0;
+  memset (mhsink->priority_stats, 0, sizeof (mhsink->priority_stats));
+  mhsink->frame_interval = 0;
+  mhsink->last_pts = GST_CLOCK_TIME_NONE;
 
   if (mhsclass->init) {
     mhsclass->init (mhsink);
@@ -2176,6 +2938,7 @@ gst_multi_handle_sink_stop (GstBaseSink * bsink)
       gst_buffer_unref (buf);
       mhsink->bufqueue = g_array_remove_index (mhsink->bufqueue, i);
     }
+    g_array_set_size (mhsink->bufqueue_times, 0);
     /* freeing the array is done in _finalize */
   }
   GST_OBJECT_FLAG_UNSET (mhsink, GST_MULTI_HANDLE_SINK_OPEN);
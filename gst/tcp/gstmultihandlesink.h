@@ -121,6 +121,27 @@ typedef enum
   GST_CLIENT_STATUS_FLUSHING    = 6
 } GstClientStatus;
 
+/**
+ * GstClientPriority:
+ * @GST_CLIENT_PRIORITY_HIGH: latency sensitive client, served first
+ * @GST_CLIENT_PRIORITY_LOW : bulk client, only served when no high priority
+ *                            client is waiting to be written to
+ *
+ * The priority class of a client, set with the "priority" option of
+ * add-with-options.
+ */
+typedef enum
+{
+  GST_CLIENT_PRIORITY_HIGH      = 0,
+  GST_CLIENT_PRIORITY_LOW       = 1
+} GstClientPriority;
+
+#define GST_CLIENT_PRIORITY_N 2
+
+/* buckets of the per-client send latency histogram: [0, 1ms), [1ms, 2ms),
+ * [2ms, 4ms) and so on, the last one is open ended */
+#define GST_CLIENT_LATENCY_BUCKETS 10
+
 // FIXME: is it better to use GSocket * or a gpointer here ?
 typedef union
 {
@@ -136,20 +157,28 @@ typedef struct {
 
   gchar debug[30];              /* a debug string used in debug calls to
                                    identify the client */
-  gint bufpos;                  /* position of this client in the global queue */
+  struct _GstMultiHandleClientTable *table; /* table holding our hot state */
+  guint slot;                   /* index of this client in @table */
   gint flushcount;              /* the remaining number of buffers to flush out or -1 if the 
                                    client is not flushing. */
 
-  GstClientStatus status;
-
   GSList *sending;              /* the buffers we need to send */
   gint bufoffset;               /* offset in the first buffer */
 
   gboolean discont;
 
-  gboolean new_connection;
   gboolean currently_removing;
 
+  GstClientPriority priority;
+
+  /* credit based flow control, -1 if the client doesn't use it */
+  gint credit;                  /* buffers we may send before the next grant */
+  guint64 credit_granted;       /* total credit ever granted */
+
+  /* consumption measurement for adaptive-limits */
+  GstClockTime consume_delay;   /* average time from queueing a buffer to
+                                   taking it for this client */
+  GstClockTime consume_jitter;  /* average deviation from that */
 
   /* method to sync client when connecting */
   GstSyncMethod sync_method;
@@ -162,15 +191,66 @@ typedef struct {
 
   /* stats */
   guint64 bytes_sent;
+  guint64 buffers_stale;        /* skipped for being older than max-frame-age */
+  guint64 send_latency[GST_CLIENT_LATENCY_BUCKETS];
   guint64 connect_time;
   guint64 disconnect_time;
-  guint64 last_activity_time;
-  guint64 dropped_buffers;
   guint64 avg_queue_size;
   guint64 first_buffer_ts;
   guint64 last_buffer_ts;
 } GstMultiHandleClient;
 
+/* Clients are checked for inactivity on a hashed timer wheel with
+ * GST_MULTI_HANDLE_TIMER_WHEEL_SIZE buckets of GST_MULTI_HANDLE_TIMER_TICK
+ * each.  One extra list holds the clients that have expired but are not
+ * removed yet. */
+#define GST_MULTI_HANDLE_TIMER_WHEEL_SIZE 256
+#define GST_MULTI_HANDLE_TIMER_TICK       (16 * GST_MSECOND)
+#define GST_MULTI_HANDLE_TIMER_EXPIRED    GST_MULTI_HANDLE_TIMER_WHEEL_SIZE
+
+/* The per-client state that is touched for every queued buffer, kept as a
+ * structure of arrays indexed by client slot so that the per-frame walk over
+ * all clients stays within a few cache lines.  Slots are stable for the
+ * lifetime of a client; free slots have a NULL @client entry and are reused
+ * by later clients.  Everything else about a client lives in its
+ * GstMultiHandleClient. */
+typedef struct _GstMultiHandleClientTable {
+  guint size;                   /* number of allocated slots */
+  guint end;                    /* one past the highest slot ever used */
+
+  gint *bufpos;                 /* position of the client in the global queue */
+  GstClientStatus *status;
+  guint64 *last_activity_time;  /* coarse monotonic time */
+  guint64 *dropped_buffers;
+  gboolean *new_connection;
+  GstClockTime *min_frame_interval; /* from the max-framerate option, 0 = all */
+  GstClockTime *next_frame_time; /* earliest PTS the client wants next */
+  gint *wanted_soft_max;        /* adaptive limits in buffers, 0 = unknown */
+  gint *wanted_max;
+
+  /* timer wheel links, G_MAXUINT terminated */
+  guint *timer_next;
+  guint *timer_prev;
+  guint *timer_list;            /* bucket the slot is linked into */
+  guint timer_heads[GST_MULTI_HANDLE_TIMER_WHEEL_SIZE + 1];
+  guint64 timer_tick;           /* first tick that was not processed yet */
+
+  GstMultiHandleClient **client; /* cold client state, NULL for free slots */
+
+  guint *free_slots;            /* stack of free slots below @end */
+  guint n_free;
+} GstMultiHandleClientTable;
+
+#define CLIENT_BUFPOS(c)              ((c)->table->bufpos[(c)->slot])
+#define CLIENT_STATUS(c)              ((c)->table->status[(c)->slot])
+#define CLIENT_LAST_ACTIVITY_TIME(c)  ((c)->table->last_activity_time[(c)->slot])
+#define CLIENT_DROPPED_BUFFERS(c)     ((c)->table->dropped_buffers[(c)->slot])
+#define CLIENT_NEW_CONNECTION(c)      ((c)->table->new_connection[(c)->slot])
+#define CLIENT_MIN_FRAME_INTERVAL(c)  ((c)->table->min_frame_interval[(c)->slot])
+#define CLIENT_NEXT_FRAME_TIME(c)     ((c)->table->next_frame_time[(c)->slot])
+#define CLIENT_WANTED_SOFT_MAX(c)     ((c)->table->wanted_soft_max[(c)->slot])
+#define CLIENT_WANTED_MAX(c)          ((c)->table->wanted_max[(c)->slot])
+
 #define CLIENTS_LOCK_INIT(mhsink)       (g_rec_mutex_init(&(mhsink)->clientslock))
 #define CLIENTS_LOCK_CLEAR(mhsink)      (g_rec_mutex_clear(&(mhsink)->clientslock))
 #define CLIENTS_LOCK(mhsink)            (g_rec_mutex_lock(&(mhsink)->clientslock))
@@ -193,9 +273,8 @@ struct _GstMultiHandleSink {
   guint64 bytes_to_serve; /* how much bytes we must serve */
   guint64 bytes_served; /* how much bytes have we served */
 
-  GRecMutex clientslock;  /* lock to protect the clients list */
-  GList *clients;       /* list of clients we are serving */
-  guint clients_cookie; /* Cookie to detect changes to the clients list */
+  GRecMutex clientslock;  /* lock to protect the clients table */
+  GstMultiHandleClientTable table; /* the clients we are serving */
 
   GHashTable *handle_hash;  /* index of handle -> GstMultiHandleClient */
 
@@ -208,6 +287,7 @@ struct _GstMultiHandleSink {
   gint qos_dscp;
 
   GArray *bufqueue;     /* global queue of buffers */
+  GArray *bufqueue_times; /* coarse time each buffer in bufqueue was queued */
 
   gboolean running;     /* the thread state */
   GThread *thread;      /* the sender thread */
@@ -218,7 +298,11 @@ struct _GstMultiHandleSink {
   gint64 units_max;       /* max units to queue for a client */
   gint64 units_soft_max;  /* max units a client can lag before recovery starts */
   GstRecoverPolicy recover_policy;
+  gboolean adaptive_limits; /* size limits per client within the above */
+  GstClockTime frame_interval; /* average PTS difference of queued buffers */
+  GstClockTime last_pts;
   GstClockTime timeout; /* max amount of nanoseconds to remain idle */
+  GstClockTime max_frame_age; /* don't send buffers captured longer ago */
 
   GstSyncMethod def_sync_method;    /* what method to use for connecting clients */
   GstFormat     def_burst_format;
@@ -233,6 +317,19 @@ struct _GstMultiHandleSink {
 
   gboolean resend_streamheader; /* resend streamheader if it changes */
 
+  gboolean inline_send; /* write to idle clients from the streaming thread */
+  gint burst_latest;    /* queued buffers to send to new sync-method=latest
+                           clients */
+  GArray *deferred;     /* slots of low priority clients to wake up */
+
+  /* queue-to-send latency per priority class, protected by the clients
+   * lock */
+  struct {
+    guint64 buffers;
+    GstClockTime total_latency;
+    GstClockTime max_latency;
+  } priority_stats[GST_CLIENT_PRIORITY_N];
+
   /* stats */
   gint buffers_queued;  /* number of queued buffers */
   gint bytes_queued;    /* number of queued bytes */
@@ -255,6 +352,10 @@ struct _GstMultiHandleSinkClass {
                                  GstBuffer *buffer);
   int           (*client_get_fd)
                                 (GstMultiHandleClient *client);
+  /* write as much as possible to a client without blocking, returns FALSE
+   * if the client should be removed */
+  gboolean      (*client_write) (GstMultiHandleSink *sink,
+                                 GstMultiHandleClient *client);
   void          (*client_free)  (GstMultiHandleSink   *mhsink,
                                  GstMultiHandleClient *client);
   void          (*handle_debug) (GstMultiSinkHandle handle, gchar debug[30]);
@@ -282,13 +383,27 @@ void          gst_multi_handle_sink_add          (GstMultiHandleSink *sink, GstM
 void          gst_multi_handle_sink_add_full     (GstMultiHandleSink *sink, GstMultiSinkHandle handle, GstSyncMethod sync,
                                               GstFormat min_format, guint64 min_value,
                                               GstFormat max_format, guint64 max_value);
+void          gst_multi_handle_sink_add_with_options (GstMultiHandleSink *sink, GstMultiSinkHandle handle,
+                                              const GstStructure *options);
 void          gst_multi_handle_sink_remove       (GstMultiHandleSink *sink, GstMultiSinkHandle handle);
 void          gst_multi_handle_sink_remove_flush (GstMultiHandleSink *sink, GstMultiSinkHandle handle);
 GstStructure*  gst_multi_handle_sink_get_stats    (GstMultiHandleSink *sink, GstMultiSinkHandle handle);
-void gst_multi_handle_sink_remove_client_link (GstMultiHandleSink * sink,
-    GList * link);
+void gst_multi_handle_sink_remove_client (GstMultiHandleSink * sink,
+    GstMultiHandleClient * client);
 
 void gst_multi_handle_sink_client_init (GstMultiHandleClient * client, GstSyncMethod sync_method);
+void gst_multi_handle_sink_client_add_credit (GstMultiHandleSink * sink,
+    GstMultiHandleClient * client, guint credit);
+gboolean gst_multi_handle_sink_client_skip_buffer (GstMultiHandleClient * client,
+    GstBuffer * buffer);
+gboolean gst_multi_handle_sink_client_drop_stale (GstMultiHandleSink * sink,
+    GstMultiHandleClient * client, GstClockTime now);
+void gst_multi_handle_sink_client_take_buffer (GstMultiHandleSink * sink,
+    GstMultiHandleClient * client, gint pos, GstClockTime now);
+
+GstClockTime gst_multi_handle_sink_coarse_now (void);
+gboolean gst_multi_handle_sink_expire_clients (GstMultiHandleSink * sink,
+    GstClockTime now);
 
 #define GST_TYPE_RECOVER_POLICY (gst_multi_handle_sink_recover_policy_get_type())
 GType gst_multi_handle_sink_recover_policy_get_type (void);
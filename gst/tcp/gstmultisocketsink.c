@@ -103,6 +103,7 @@
 #endif
 
 #include "../gstnetcontrolmessagemeta.h"
+#include "../tmpfile/wire-protocol.h"
 
 #include <string.h>
 
@@ -123,6 +124,7 @@ enum
   /* methods */
   SIGNAL_ADD,
   SIGNAL_ADD_BURST,
+  SIGNAL_ADD_WITH_OPTIONS,
   SIGNAL_REMOVE,
   SIGNAL_REMOVE_FLUSH,
   SIGNAL_GET_STATS,
@@ -149,6 +151,8 @@ static void gst_multi_socket_sink_add (GstMultiSocketSink * sink,
 static void gst_multi_socket_sink_add_full (GstMultiSocketSink * sink,
     GSocket * socket, GstSyncMethod sync, GstFormat min_format,
     guint64 min_value, GstFormat max_format, guint64 max_value);
+static void gst_multi_socket_sink_add_with_options (GstMultiSocketSink * sink,
+    GSocket * socket, const GstStructure * options);
 static void gst_multi_socket_sink_remove (GstMultiSocketSink * sink,
     GSocket * socket);
 static void gst_multi_socket_sink_remove_flush (GstMultiSocketSink * sink,
@@ -169,6 +173,8 @@ static GstMultiHandleClient
     * gst_multi_socket_sink_new_client (GstMultiHandleSink * mhsink,
     GstMultiSinkHandle handle, GstSyncMethod sync_method);
 static int gst_multi_socket_sink_client_get_fd (GstMultiHandleClient * client);
+static gboolean gst_multi_socket_sink_client_write (GstMultiHandleSink * mhsink,
+    GstMultiHandleClient * client);
 static void gst_multi_socket_sink_client_free (GstMultiHandleSink * mhsink,
     GstMultiHandleClient * client);
 static void gst_multi_socket_sink_handle_debug (GstMultiSinkHandle handle,
@@ -253,6 +259,33 @@ gst_multi_socket_sink_class_init (GstMultiSocketSinkClass * klass)
       g_cclosure_marshal_generic, G_TYPE_NONE, 6,
       G_TYPE_SOCKET, GST_TYPE_SYNC_METHOD, GST_TYPE_FORMAT, G_TYPE_UINT64,
       GST_TYPE_FORMAT, G_TYPE_UINT64);
+  /**
+   * GstMultiSocketSink::add-with-options:
+   * @gstmultisocketsink: the multisocketsink element to emit this signal on
+   * @socket:             the socket to add to multisocketsink
+   * @options:            a #GstStructure with options for this client
+   *
+   * Hand the given open socket to multisocketsink to write to with per-client
+   * options.  The options are applied before the first buffer is sent.
+   * Supported fields:
+   *
+   *  - "max-framerate" (#GstFraction): don't send this client more than this
+   *    many buffers per second.  Buffers are skipped based on their PTS.
+   *  - "priority" (string): "high" (the default) or "low".  High priority
+   *    clients are written to first, low priority clients are only served
+   *    when no high priority client is waiting.
+   *  - "credit" (boolean): credit based flow control.  Nothing is sent to the
+   *    client until it grants credit by writing CreditMessages (see
+   *    wire-protocol.h) to the socket, and every buffer sent uses up one
+   *    credit.  Buffers the client has no credit for stay in our queue where
+   *    the usual limits apply, instead of in the socket buffers.
+   */
+  gst_multi_socket_sink_signals[SIGNAL_ADD_WITH_OPTIONS] =
+      g_signal_new ("add-with-options", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_STRUCT_OFFSET (GstMultiSocketSinkClass, add_with_options), NULL, NULL,
+      g_cclosure_marshal_generic, G_TYPE_NONE, 2, G_TYPE_SOCKET,
+      GST_TYPE_STRUCTURE);
   /**
    * GstMultiSocketSink::remove:
    * @gstmultisocketsink: the multisocketsink element to emit this signal on
@@ -290,7 +323,12 @@ gst_multi_socket_sink_class_init (GstMultiSocketSinkClass * klass)
    *     values that represent: total number of bytes sent, time
    *     when the client was added, time when the client was
    *     disconnected/removed, time the client is/was active, last activity
-   *     time (in epoch seconds), number of buffers dropped.
+   *     time (in epoch seconds), number of buffers dropped, the number of
+   *     buffers queued for the client and, for clients using credit based
+   *     flow control, their remaining and total granted credit.  The
+   *     "send-latency-histogram" array counts the buffers sent with a
+   *     queue-to-send latency of [0, 1ms), [1ms, 2ms), [2ms, 4ms) and so
+   *     on, with the last bucket open ended.
    *     All times are expressed in nanoseconds (GstClockTime).
    */
   gst_multi_socket_sink_signals[SIGNAL_GET_STATS] =
@@ -361,6 +399,8 @@ gst_multi_socket_sink_class_init (GstMultiSocketSinkClass * klass)
 
   klass->add = GST_DEBUG_FUNCPTR (gst_multi_socket_sink_add);
   klass->add_full = GST_DEBUG_FUNCPTR (gst_multi_socket_sink_add_full);
+  klass->add_with_options =
+      GST_DEBUG_FUNCPTR (gst_multi_socket_sink_add_with_options);
   klass->remove = GST_DEBUG_FUNCPTR (gst_multi_socket_sink_remove);
   klass->remove_flush = GST_DEBUG_FUNCPTR (gst_multi_socket_sink_remove_flush);
   klass->get_stats = GST_DEBUG_FUNCPTR (gst_multi_socket_sink_get_stats);
@@ -382,6 +422,8 @@ gst_multi_socket_sink_class_init (GstMultiSocketSinkClass * klass)
       GST_DEBUG_FUNCPTR (gst_multi_socket_sink_new_client);
   gstmultihandlesink_class->client_get_fd =
       GST_DEBUG_FUNCPTR (gst_multi_socket_sink_client_get_fd);
+  gstmultihandlesink_class->client_write =
+      GST_DEBUG_FUNCPTR (gst_multi_socket_sink_client_write);
   gstmultihandlesink_class->client_free =
       GST_DEBUG_FUNCPTR (gst_multi_socket_sink_client_free);
   gstmultihandlesink_class->handle_debug =
@@ -461,6 +503,17 @@ gst_multi_socket_sink_add_full (GstMultiSocketSink * sink, GSocket * socket,
       sync, min_format, min_value, max_format, max_value);
 }
 
+static void
+gst_multi_socket_sink_add_with_options (GstMultiSocketSink * sink,
+    GSocket * socket, const GstStructure * options)
+{
+  GstMultiSinkHandle handle;
+
+  handle.socket = socket;
+  gst_multi_handle_sink_add_with_options (GST_MULTI_HANDLE_SINK_CAST (sink),
+      handle, options);
+}
+
 static void
 gst_multi_socket_sink_remove (GstMultiSocketSink * sink, GSocket * socket)
 {
@@ -551,8 +604,42 @@ gst_multi_socket_sink_handle_hash_key (GstMultiSinkHandle handle)
   return handle.socket;
 }
 
+/* feeds @len bytes read from @client into its CreditMessage parser */
+static gboolean
+gst_multi_socket_sink_parse_credit (GstMultiSocketSink * sink,
+    GstSocketClient * client, const gchar * data, gsize len)
+{
+  GstMultiHandleClient *mhclient = (GstMultiHandleClient *) client;
+  CreditMessage msg;
+
+  G_STATIC_ASSERT (sizeof (client->credit_msg) == sizeof (CreditMessage));
+
+  while (len > 0) {
+    gsize n = MIN (len, sizeof (msg) - client->credit_msg_len);
+
+    memcpy (client->credit_msg + client->credit_msg_len, data, n);
+    client->credit_msg_len += n;
+    data += n;
+    len -= n;
+
+    if (client->credit_msg_len < sizeof (msg))
+      break;
+
+    memcpy (&msg, client->credit_msg, sizeof (msg));
+    client->credit_msg_len = 0;
+    if (msg.magic != CREDIT_MESSAGE_MAGIC) {
+      GST_WARNING_OBJECT (sink, "%s sent invalid credit message %08x",
+          mhclient->debug, msg.magic);
+      return FALSE;
+    }
+    gst_multi_handle_sink_client_add_credit (GST_MULTI_HANDLE_SINK (sink),
+        mhclient, msg.credit);
+  }
+  return TRUE;
+}
+
 /* handle a read on a client socket,
- * which either indicates a close or should be ignored
+ * which either indicates a close, grants credit or should be ignored
  * returns FALSE if some error occured or the client closed. */
 static gboolean
 gst_multi_socket_sink_handle_client_read (GstMultiSocketSink * sink,
@@ -569,9 +656,9 @@ gst_multi_socket_sink_handle_client_read (GstMultiSocketSink * sink,
 
   ret = TRUE;
 
-  /* just Read 'n' Drop, could also just drop the client as it's not supposed
-   * to write to us except for closing the socket, I guess it's because we
-   * like to listen to our customers. */
+  /* clients using credit based flow control send us CreditMessages, all other
+   * clients are not supposed to write to us except for closing the socket so
+   * we just Read 'n' Drop. */
   do {
     gssize navail;
 
@@ -588,12 +675,17 @@ gst_multi_socket_sink_handle_client_read (GstMultiSocketSink * sink,
       /* client sent close, so remove it */
       GST_DEBUG_OBJECT (sink, "%s client asked for close, removing",
           mhclient->debug);
-      mhclient->status = GST_CLIENT_STATUS_CLOSED;
+      CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_CLOSED;
       ret = FALSE;
     } else if (nread < 0) {
       GST_WARNING_OBJECT (sink, "%s could not read: %s",
           mhclient->debug, err->message);
-      mhclient->status = GST_CLIENT_STATUS_ERROR;
+      CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_ERROR;
+      ret = FALSE;
+      break;
+    } else if (mhclient->credit >= 0 &&
+        !gst_multi_socket_sink_parse_credit (sink, client, dummy, nread)) {
+      CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_ERROR;
       ret = FALSE;
       break;
     }
@@ -705,7 +797,6 @@ gst_multi_socket_sink_handle_client_write (GstMultiSocketSink * sink,
   gboolean more;
   gboolean flushing;
   GstClockTime now;
-  GTimeVal nowtv;
   GError *err = NULL;
   GstMultiHandleSink *mhsink = GST_MULTI_HANDLE_SINK (sink);
   GstMultiHandleClient *mhclient = (GstMultiHandleClient *) client;
@@ -713,16 +804,15 @@ gst_multi_socket_sink_handle_client_write (GstMultiSocketSink * sink,
       GST_MULTI_HANDLE_SINK_GET_CLASS (mhsink);
 
 
-  g_get_current_time (&nowtv);
-  now = GST_TIMEVAL_TO_TIME (nowtv);
+  now = gst_multi_handle_sink_coarse_now ();
 
-  flushing = mhclient->status == GST_CLIENT_STATUS_FLUSHING;
+  flushing = CLIENT_STATUS (mhclient) == GST_CLIENT_STATUS_FLUSHING;
 
   more = TRUE;
   do {
     if (!mhclient->sending) {
       /* client is not working on a buffer */
-      if (mhclient->bufpos == -1) {
+      if (CLIENT_BUFPOS (mhclient) == -1) {
         /* client is too fast, remove from write queue until new buffer is
          * available */
         /* FIXME: specific */
@@ -741,17 +831,18 @@ gst_multi_socket_sink_handle_client_write (GstMultiSocketSink * sink,
         /* client can pick a buffer from the global queue */
         GstBuffer *buf;
         GstClockTime timestamp;
+        gint pos;
 
         /* for new connections, we need to find a good spot in the
          * bufqueue to start streaming from */
-        if (mhclient->new_connection && !flushing) {
+        if (CLIENT_NEW_CONNECTION (mhclient) && !flushing) {
           gint position =
               gst_multi_handle_sink_new_client_position (mhsink, mhclient);
 
           if (position >= 0) {
             /* we got a valid spot in the queue */
-            mhclient->new_connection = FALSE;
-            mhclient->bufpos = position;
+            CLIENT_NEW_CONNECTION (mhclient) = FALSE;
+            CLIENT_BUFPOS (mhclient) = position;
           } else {
             /* cannot send data to this client yet */
             /* FIXME: specific */
@@ -769,9 +860,35 @@ gst_multi_socket_sink_handle_client_write (GstMultiSocketSink * sink,
         if (mhclient->flushcount == 0)
           goto flushed;
 
+        /* out of credit, only listen for the next grant. The buffers stay
+         * in our queue, where the limits apply to them. */
+        if (mhclient->credit == 0) {
+          GST_LOG_OBJECT (sink, "%s has no credit", mhclient->debug);
+          gst_multi_socket_sink_hash_adding (mhsink, mhclient);
+          return TRUE;
+        }
+
+        /* don't send buffers that are too old to be of use, this may leave
+         * us with nothing to send */
+        if (!flushing && gst_multi_handle_sink_client_drop_stale (mhsink,
+                mhclient, now))
+          continue;
+
         /* grab buffer */
-        buf = g_array_index (mhsink->bufqueue, GstBuffer *, mhclient->bufpos);
-        mhclient->bufpos--;
+        pos = CLIENT_BUFPOS (mhclient);
+        buf = g_array_index (mhsink->bufqueue, GstBuffer *, pos);
+        CLIENT_BUFPOS (mhclient)--;
+
+        if (!flushing && gst_multi_handle_sink_client_skip_buffer (mhclient,
+                buf)) {
+          GST_LOG_OBJECT (sink, "%s skipping buffer %p for max-framerate",
+              mhclient->debug, buf);
+          continue;
+        }
+        gst_multi_handle_sink_client_take_buffer (mhsink, mhclient, pos, now);
+
+        if (mhclient->credit > 0)
+          mhclient->credit--;
 
         /* update stats */
         timestamp = GST_BUFFER_TIMESTAMP (buf);
@@ -785,7 +902,7 @@ gst_multi_socket_sink_handle_client_write (GstMultiSocketSink * sink,
           mhclient->flushcount--;
 
         GST_LOG_OBJECT (sink, "%s client %p at position %d",
-            mhclient->debug, client, mhclient->bufpos);
+            mhclient->debug, client, CLIENT_BUFPOS (mhclient));
 
         /* queueing a buffer will ref it */
         mhsinkclass->client_queue_buffer (mhsink, mhclient, buf);
@@ -834,7 +951,7 @@ gst_multi_socket_sink_handle_client_write (GstMultiSocketSink * sink,
         }
         /* update stats */
         mhclient->bytes_sent += wrote;
-        mhclient->last_activity_time = now;
+        CLIENT_LAST_ACTIVITY_TIME (mhclient) = now;
         mhsink->bytes_served += wrote;
       }
     }
@@ -846,14 +963,14 @@ gst_multi_socket_sink_handle_client_write (GstMultiSocketSink * sink,
 flushed:
   {
     GST_DEBUG_OBJECT (sink, "%s flushed, removing", mhclient->debug);
-    mhclient->status = GST_CLIENT_STATUS_REMOVED;
+    CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_REMOVED;
     return FALSE;
   }
 connection_reset:
   {
     GST_DEBUG_OBJECT (sink, "%s connection reset by peer, removing",
         mhclient->debug);
-    mhclient->status = GST_CLIENT_STATUS_CLOSED;
+    CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_CLOSED;
     g_clear_error (&err);
     return FALSE;
   }
@@ -863,11 +980,21 @@ write_error:
         "%s could not write, removing client: %s", mhclient->debug,
         err->message);
     g_clear_error (&err);
-    mhclient->status = GST_CLIENT_STATUS_ERROR;
+    CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_ERROR;
     return FALSE;
   }
 }
 
+/* called from the streaming thread with the clients lock held when
+ * inline-send is enabled. Our sockets are non-blocking so this is safe. */
+static gboolean
+gst_multi_socket_sink_client_write (GstMultiHandleSink * mhsink,
+    GstMultiHandleClient * client)
+{
+  return gst_multi_socket_sink_handle_client_write (GST_MULTI_SOCKET_SINK
+      (mhsink), (GstSocketClient *) client);
+}
+
 static gsize
 gst_buffer_get_cmsg_list (GstBuffer * buf, GSocketControlMessage ** msgs,
     gsize msg_space)
@@ -919,14 +1046,32 @@ gst_multi_socket_sink_hash_adding (GstMultiHandleSink * mhsink,
 {
   GstMultiSocketSink *sink = GST_MULTI_SOCKET_SINK (mhsink);
   GstSocketClient *client = (GstSocketClient *) (mhclient);
+  GIOCondition condition = G_IO_IN | G_IO_PRI | G_IO_ERR | G_IO_HUP;
 
   if (!sink->main_context)
     return;
 
+  /* a client without credit can't be written to, so don't get woken up
+   * because its socket is writable */
+  if (mhclient->credit != 0)
+    condition |= G_IO_OUT;
+
+  if (client->source && client->condition != condition) {
+    g_source_destroy (client->source);
+    g_source_unref (client->source);
+    client->source = NULL;
+  }
+
   if (!client->source) {
+    client->condition = condition;
     client->source =
-        g_socket_create_source (mhclient->handle.socket,
-        G_IO_IN | G_IO_OUT | G_IO_PRI | G_IO_ERR | G_IO_HUP, sink->cancellable);
+        g_socket_create_source (mhclient->handle.socket, condition,
+        sink->cancellable);
+    /* the main loop only dispatches the low priority clients when none of
+     * the high priority ones is ready */
+    g_source_set_priority (client->source,
+        mhclient->priority == GST_CLIENT_PRIORITY_LOW ? G_PRIORITY_LOW :
+        G_PRIORITY_HIGH);
     g_source_set_callback (client->source,
         (GSourceFunc) gst_multi_socket_sink_socket_condition,
         gst_object_ref (sink), (GDestroyNotify) gst_object_unref);
@@ -955,7 +1100,6 @@ static gboolean
 gst_multi_socket_sink_socket_condition (GstMultiSinkHandle handle,
     GIOCondition condition, GstMultiSocketSink * sink)
 {
-  GList *clink;
   GstSocketClient *client;
   gboolean ret = TRUE;
   GstMultiHandleClient *mhclient;
@@ -964,45 +1108,44 @@ gst_multi_socket_sink_socket_condition (GstMultiSinkHandle handle,
       GST_MULTI_HANDLE_SINK_GET_CLASS (mhsink);
 
   CLIENTS_LOCK (mhsink);
-  clink = g_hash_table_lookup (mhsink->handle_hash,
+  client = g_hash_table_lookup (mhsink->handle_hash,
       mhsinkclass->handle_hash_key (handle));
-  if (clink == NULL) {
+  if (client == NULL) {
     ret = FALSE;
     goto done;
   }
 
-  client = clink->data;
   mhclient = (GstMultiHandleClient *) client;
 
-  if (mhclient->status != GST_CLIENT_STATUS_FLUSHING
-      && mhclient->status != GST_CLIENT_STATUS_OK) {
-    gst_multi_handle_sink_remove_client_link (mhsink, clink);
+  if (CLIENT_STATUS (mhclient) != GST_CLIENT_STATUS_FLUSHING
+      && CLIENT_STATUS (mhclient) != GST_CLIENT_STATUS_OK) {
+    gst_multi_handle_sink_remove_client (mhsink, mhclient);
     ret = FALSE;
     goto done;
   }
 
   if ((condition & G_IO_ERR)) {
     GST_WARNING_OBJECT (sink, "%s has error", mhclient->debug);
-    mhclient->status = GST_CLIENT_STATUS_ERROR;
-    gst_multi_handle_sink_remove_client_link (mhsink, clink);
+    CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_ERROR;
+    gst_multi_handle_sink_remove_client (mhsink, mhclient);
     ret = FALSE;
     goto done;
   } else if ((condition & G_IO_HUP)) {
-    mhclient->status = GST_CLIENT_STATUS_CLOSED;
-    gst_multi_handle_sink_remove_client_link (mhsink, clink);
+    CLIENT_STATUS (mhclient) = GST_CLIENT_STATUS_CLOSED;
+    gst_multi_handle_sink_remove_client (mhsink, mhclient);
     ret = FALSE;
     goto done;
   } else if ((condition & G_IO_IN) || (condition & G_IO_PRI)) {
     /* handle client read */
     if (!gst_multi_socket_sink_handle_client_read (sink, client)) {
-      gst_multi_handle_sink_remove_client_link (mhsink, clink);
+      gst_multi_handle_sink_remove_client (mhsink, mhclient);
       ret = FALSE;
       goto done;
     }
   } else if ((condition & G_IO_OUT)) {
     /* handle client write */
     if (!gst_multi_socket_sink_handle_client_write (sink, client)) {
-      gst_multi_handle_sink_remove_client_link (mhsink, clink);
+      gst_multi_handle_sink_remove_client (mhsink, mhclient);
       ret = FALSE;
       goto done;
     }
@@ -1017,30 +1160,14 @@ done:
 static gboolean
 gst_multi_socket_sink_timeout (GstMultiSocketSink * sink)
 {
-  GstClockTime now;
-  GTimeVal nowtv;
-  GList *clients;
   GstMultiHandleSink *mhsink = GST_MULTI_HANDLE_SINK (sink);
 
-  g_get_current_time (&nowtv);
-  now = GST_TIMEVAL_TO_TIME (nowtv);
-
   CLIENTS_LOCK (mhsink);
-  for (clients = mhsink->clients; clients; clients = clients->next) {
-    GstSocketClient *client;
-    GstMultiHandleClient *mhclient;
-
-    client = clients->data;
-    mhclient = (GstMultiHandleClient *) client;
-    if (mhsink->timeout > 0
-        && now - mhclient->last_activity_time > mhsink->timeout) {
-      mhclient->status = GST_CLIENT_STATUS_SLOW;
-      gst_multi_handle_sink_remove_client_link (mhsink, clients);
-    }
-  }
+  gst_multi_handle_sink_expire_clients (mhsink,
+      gst_multi_handle_sink_coarse_now ());
   CLIENTS_UNLOCK (mhsink);
 
-  return FALSE;
+  return TRUE;
 }
 
 /* we handle the client communication in another thread so that we do not block
@@ -1049,28 +1176,31 @@ static gpointer
 gst_multi_socket_sink_thread (GstMultiHandleSink * mhsink)
 {
   GstMultiSocketSink *sink = GST_MULTI_SOCKET_SINK (mhsink);
-  GSource *timeout = NULL;
+  GSource *timer = NULL;
 
   while (mhsink->running) {
-    if (mhsink->timeout > 0) {
-      timeout = g_timeout_source_new (mhsink->timeout / GST_MSECOND);
-
-      g_source_set_callback (timeout,
+    /* one timer ticks the client timeout wheel for as long as a timeout is
+     * configured. It is created once, not for every iteration. */
+    if (mhsink->timeout > 0 && timer == NULL) {
+      timer = g_timeout_source_new (GST_MULTI_HANDLE_TIMER_TICK / GST_MSECOND);
+      g_source_set_callback (timer,
           (GSourceFunc) gst_multi_socket_sink_timeout, gst_object_ref (sink),
           (GDestroyNotify) gst_object_unref);
-      g_source_attach (timeout, sink->main_context);
+      g_source_attach (timer, sink->main_context);
+    } else if (mhsink->timeout == 0 && timer != NULL) {
+      g_source_destroy (timer);
+      g_source_unref (timer);
+      timer = NULL;
     }
 
     /* Returns after handling all pending events or when
-     * _wakeup() was called. In any case we have to add
-     * a new timeout because something happened.
-     */
+     * _wakeup() was called. */
     g_main_context_iteration (sink->main_context, TRUE);
+  }
 
-    if (timeout) {
-      g_source_destroy (timeout);
-      g_source_unref (timeout);
-    }
+  if (timer) {
+    g_source_destroy (timer);
+    g_source_unref (timer);
   }
 
   return NULL;
@@ -1105,18 +1235,18 @@ gst_multi_socket_sink_start_pre (GstMultiHandleSink * mhsink)
   GstMultiSocketSink *mssink = GST_MULTI_SOCKET_SINK (mhsink);
   GstMultiHandleSinkClass *mhsinkclass =
       GST_MULTI_HANDLE_SINK_GET_CLASS (mhsink);
-  GList *clients;
+  guint slot;
 
   GST_INFO_OBJECT (mssink, "starting");
 
   mssink->main_context = g_main_context_new ();
 
   CLIENTS_LOCK (mhsink);
-  for (clients = mhsink->clients; clients; clients = clients->next) {
-    GstSocketClient *client = clients->data;
-    GstMultiHandleClient *mhclient = (GstMultiHandleClient *) client;
+  for (slot = 0; slot < mhsink->table.end; slot++) {
+    GstMultiHandleClient *mhclient = mhsink->table.client[slot];
+    GstSocketClient *client = (GstSocketClient *) mhclient;
 
-    if (client->source)
+    if (mhclient == NULL || client->source)
       continue;
     mhsinkclass->hash_adding (mhsink, mhclient);
   }
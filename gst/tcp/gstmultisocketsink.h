@@ -56,6 +56,11 @@ typedef struct {
   GstMultiHandleClient client;
 
   GSource *source;
+  GIOCondition condition;       /* what @source is watching for */
+
+  /* partially received CreditMessage */
+  guint8 credit_msg[8];
+  gsize credit_msg_len;
 } GstSocketClient;
 
 /**
@@ -80,6 +85,8 @@ struct _GstMultiSocketSinkClass {
                                  GstSyncMethod sync,
                                  GstFormat format, guint64 value,
                                  GstFormat max_format, guint64 max_value);
+  void          (*add_with_options) (GstMultiSocketSink *sink, GSocket *socket,
+                                 const GstStructure *options);
   void          (*remove)       (GstMultiSocketSink *sink, GSocket *socket);
   void          (*remove_flush) (GstMultiSocketSink *sink, GSocket *socket);
   GstStructure* (*get_stats)    (GstMultiSocketSink *sink, GSocket *socket);
@@ -43,8 +43,10 @@
 #include <gst/allocators/gstfdmemory.h>
 #include <gio/gunixfdmessage.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -61,10 +63,29 @@ static gboolean gst_fddepay_set_clock (GstElement * element,
 static GstCaps *gst_fddepay_transform_caps (GstBaseTransform * trans,
     GstPadDirection direction, GstCaps * caps, GstCaps * filter);
 static void gst_fddepay_dispose (GObject * object);
+static void gst_fddepay_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_fddepay_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 
 static GstFlowReturn gst_fddepay_transform_ip (GstBaseTransform * trans,
     GstBuffer * buf);
 
+enum
+{
+  PROP_0,
+  PROP_PREFETCH,
+  PROP_WRITABLE,
+};
+
+#define DEFAULT_PREFETCH FALSE
+#define DEFAULT_WRITABLE FALSE
+
+/* Since Linux 5.14 */
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
 /* pad templates */
 
 static GstStaticCaps fd_caps = GST_STATIC_CAPS ("application/x-fd");
@@ -109,6 +130,21 @@ gst_fddepay_class_init (GstFddepayClass * klass)
       "William Manley <will@williammanley.net>");
 
   gobject_class->dispose = gst_fddepay_dispose;
+  gobject_class->set_property = gst_fddepay_set_property;
+  gobject_class->get_property = gst_fddepay_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_PREFETCH,
+      g_param_spec_boolean ("prefetch", "Prefetch",
+          "Map each frame and fault its pages in before pushing it so the "
+          "first element downstream to read it doesn't have to",
+          DEFAULT_PREFETCH, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_WRITABLE,
+      g_param_spec_boolean ("writable", "Writable",
+          "Output writable frames backed by a private copy-on-write mapping "
+          "so downstream can modify them in place and only pays for the "
+          "pages it touches", DEFAULT_WRITABLE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gstelement_class->set_clock = GST_DEBUG_FUNCPTR (gst_fddepay_set_clock);
   base_transform_class->transform_caps =
       GST_DEBUG_FUNCPTR (gst_fddepay_transform_caps);
@@ -126,6 +162,8 @@ gst_fddepay_init (GstFddepay * fddepay)
   fddepay->monotonic_clock = g_object_new (GST_TYPE_SYSTEM_CLOCK,
       "clock-type", GST_CLOCK_TYPE_MONOTONIC, NULL);
   GST_OBJECT_FLAG_SET (fddepay->monotonic_clock, GST_CLOCK_FLAG_CAN_SET_MASTER);
+  fddepay->prefetch = DEFAULT_PREFETCH;
+  fddepay->writable = DEFAULT_WRITABLE;
 }
 
 void
@@ -145,6 +183,52 @@ gst_fddepay_dispose (GObject * object)
   G_OBJECT_CLASS (gst_fddepay_parent_class)->dispose (object);
 }
 
+static void
+gst_fddepay_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstFddepay *fddepay = GST_FDDEPAY (object);
+
+  switch (prop_id) {
+    case PROP_PREFETCH:
+      GST_OBJECT_LOCK (fddepay);
+      fddepay->prefetch = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (fddepay);
+      break;
+    case PROP_WRITABLE:
+      GST_OBJECT_LOCK (fddepay);
+      fddepay->writable = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (fddepay);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_fddepay_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstFddepay *fddepay = GST_FDDEPAY (object);
+
+  switch (prop_id) {
+    case PROP_PREFETCH:
+      GST_OBJECT_LOCK (fddepay);
+      g_value_set_boolean (value, fddepay->prefetch);
+      GST_OBJECT_UNLOCK (fddepay);
+      break;
+    case PROP_WRITABLE:
+      GST_OBJECT_LOCK (fddepay);
+      g_value_set_boolean (value, fddepay->writable);
+      GST_OBJECT_UNLOCK (fddepay);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static GstCaps *
 gst_fddepay_transform_caps (GstBaseTransform * trans, GstPadDirection direction,
     GstCaps * caps, GstCaps * filter)
@@ -201,6 +285,33 @@ gst_fddepay_set_clock (GstElement * element, GstClock * clock)
       clock);
 }
 
+/* Populates our page tables for @mem now, in our streaming thread, rather
+ * than leaving downstream to take a minor fault on every page.  On kernels
+ * without MADV_POPULATE_READ we can only ask for the pages to be made
+ * resident. */
+static void
+gst_fddepay_prefetch (GstFddepay * fddepay, GstMemory * mem)
+{
+  GstMapInfo info;
+  guintptr page_mask = sysconf (_SC_PAGESIZE) - 1;
+  guintptr start, end;
+
+  if (!gst_memory_map (mem, &info, GST_MAP_READ)) {
+    GST_WARNING_OBJECT (fddepay, "Failed to map memory for prefetch");
+    return;
+  }
+
+  start = (guintptr) info.data & ~page_mask;
+  end = (guintptr) info.data + info.size;
+  if (madvise ((void *) start, end - start, MADV_POPULATE_READ) != 0) {
+    if (errno != EINVAL ||
+        madvise ((void *) start, end - start, MADV_WILLNEED) != 0)
+      GST_DEBUG_OBJECT (fddepay, "Prefetch failed: %s", g_strerror (errno));
+  }
+
+  gst_memory_unmap (mem, &info);
+}
+
 static GstFlowReturn
 gst_fddepay_transform_ip (GstBaseTransform * trans, GstBuffer * buf)
 {
@@ -212,15 +323,20 @@ gst_fddepay_transform_ip (GstBaseTransform * trans, GstBuffer * buf)
   int fd = -1;
   struct stat statbuf;
   GstClockTime pipeline_clock_time, running_time;
+  gboolean prefetch, writable;
 
   GST_DEBUG_OBJECT (fddepay, "transform_ip");
 
   if (gst_buffer_get_size (buf) != sizeof (msg)) {
     /* We're guaranteed that we can't `read` from a socket across an attached
      * file descriptor so we should get the data in chunks no bigger than
-     * sizeof(FDMessage) */
-    GST_WARNING_OBJECT (fddepay, "fddepay: Received wrong amount of data "
-        "between fds.");
+     * sizeof(FDMessage).  pulsevideosrc reads exactly that much at a time so
+     * a short read would leave the rest of the message to be misread as the
+     * start of the next one.  There's no resynchronising after that. */
+    GST_ELEMENT_ERROR (fddepay, STREAM, DECODE, (NULL),
+        ("Received %" G_GSIZE_FORMAT " bytes between fds, expected an "
+            "FDMessage of %" G_GSIZE_FORMAT, gst_buffer_get_size (buf),
+            sizeof (msg)));
     goto error;
   }
 
@@ -263,11 +379,30 @@ gst_fddepay_transform_ip (GstBaseTransform * trans, GstBuffer * buf)
         fd, (ssize_t) statbuf.st_size, msg.offset, msg.size);
     goto error;
   }
-  fdmem = gst_fd_allocator_alloc (fddepay->fd_allocator, fd,
-      msg.offset + msg.size, GST_FD_MEMORY_FLAG_KEEP_MAPPED);
-  fd = -1;
-  gst_memory_resize (fdmem, msg.offset, msg.size);
-  GST_MINI_OBJECT_FLAG_SET (fdmem, GST_MEMORY_FLAG_READONLY);
+
+  GST_OBJECT_LOCK (fddepay);
+  prefetch = fddepay->prefetch;
+  writable = fddepay->writable;
+  GST_OBJECT_UNLOCK (fddepay);
+
+  if (writable) {
+    /* Writes go to pages private to this mapping so neither the sender nor
+     * later frames in the same file will see them. */
+    fdmem = gst_fd_allocator_alloc (fddepay->fd_allocator, fd,
+        msg.offset + msg.size,
+        GST_FD_MEMORY_FLAG_KEEP_MAPPED | GST_FD_MEMORY_FLAG_MAP_PRIVATE);
+    fd = -1;
+    gst_memory_resize (fdmem, msg.offset, msg.size);
+  } else {
+    fdmem = gst_fd_allocator_alloc (fddepay->fd_allocator, fd,
+        msg.offset + msg.size, GST_FD_MEMORY_FLAG_KEEP_MAPPED);
+    fd = -1;
+    gst_memory_resize (fdmem, msg.offset, msg.size);
+    GST_MINI_OBJECT_FLAG_SET (fdmem, GST_MEMORY_FLAG_READONLY);
+  }
+
+  if (prefetch)
+    gst_fddepay_prefetch (fddepay, fdmem);
 
   gst_buffer_remove_all_memory (buf);
   gst_buffer_remove_meta (buf,
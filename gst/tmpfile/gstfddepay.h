@@ -36,6 +36,9 @@ struct _GstFddepay
   GstBaseTransform base_fddepay;
   GstAllocator *fd_allocator;
   GstClock *monotonic_clock;
+
+  gboolean prefetch;
+  gboolean writable;
 };
 
 struct _GstFddepayClass
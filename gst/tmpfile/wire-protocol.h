@@ -33,4 +33,40 @@ typedef struct {
   uint64_t size;
 } FDMessage;
 
+/* Sent in the other direction by clients that asked for credit based flow
+ * control when attaching.  Each message allows the sender to send @credit more
+ * FDMessages.  A client typically grants its window size once when it starts
+ * reading and then one credit for every message it receives. */
+#define CREDIT_MESSAGE_MAGIC 0x43524454 /* "CRDT" */
+
+typedef struct {
+  uint32_t magic;
+  uint32_t credit;
+} CreditMessage;
+
+/* Handshake for attaching over pulsevideosink's listening socket rather than
+ * with VideoSource2.Attach.  The client connects and sends an AttachRequest.
+ * The server replies with an AttachReply followed by @caps_len bytes of caps
+ * string (not NUL terminated) and then sends FDMessages on the same
+ * connection.  A @caps_len of 0 means that the server can't serve us this way
+ * right now (e.g. it has no caps yet) and the client should use DBus instead.
+ */
+#define ATTACH_REQUEST_MAGIC 0x41545448 /* "ATTH" */
+#define ATTACH_REPLY_MAGIC 0x43415053 /* "CAPS" */
+
+#define ATTACH_FLAG_LOW_PRIORITY (1 << 0)
+#define ATTACH_FLAG_CREDIT (1 << 1)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t flags;
+  /* Same as the "max-framerate" Attach option, 0 for all frames */
+  double max_framerate;
+} AttachRequest;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t caps_len;
+} AttachReply;
+
 #endif
@@ -22,13 +22,14 @@ public void handle_message (Gst.Message message)
 }
 
 Gst.Pipeline create_videosource(string source, string caps, string object_path,
-    string bus_name_suffix) throws Error
+    string bus_name_suffix, int listen_fd) throws Error
 {
     // Creating pipeline and elements
     var pipeline = (Gst.Pipeline) Gst.parse_launch(
         source + " ! pvwatchdog ! pulsevideosink caps=\"" + caps
         + "\" object-path=\"" + object_path + "\" " +
-        "bus-name=\"com.stbtester.VideoSource." + bus_name_suffix + "\"");
+        "bus-name=\"com.stbtester.VideoSource." + bus_name_suffix + "\" " +
+        "listen-fd=" + listen_fd.to_string());
 
     var bus = pipeline.get_bus();
     bus.add_signal_watch();
@@ -39,6 +40,39 @@ Gst.Pipeline create_videosource(string source, string caps, string object_path,
     return pipeline;
 }
 
+// The first fd passed by socket activation, SD_LISTEN_FDS_START
+const int LISTEN_FDS_START = 3;
+
+// Returns the listening socket passed to us by systemd socket activation, or
+// -1.  See sd_listen_fds(3).  The caller owns it; pulsevideosink takes it
+// over with listen-fd.
+int get_listen_fd()
+{
+    string? pid = Environment.get_variable("LISTEN_PID");
+    string? fds = Environment.get_variable("LISTEN_FDS");
+    int fd = -1;
+    Posix.Stat st;
+
+    if (pid != null && int.parse(pid) == Posix.getpid() && fds != null &&
+            int.parse(fds) >= 1) {
+        fd = LISTEN_FDS_START;
+        if (Posix.fstat(fd, out st) != 0 || !Posix.S_ISSOCK(st.st_mode)) {
+            GLib.stderr.printf("Ignoring LISTEN_FDS: fd %d isn't a socket\n",
+                fd);
+            fd = -1;
+        } else {
+            // Like sd_listen_fds(3), so it isn't inherited by children
+            Posix.fcntl(fd, Posix.F_SETFD, Posix.FD_CLOEXEC);
+        }
+    }
+
+    // Don't pass these on to anything we start
+    Environment.unset_variable("LISTEN_PID");
+    Environment.unset_variable("LISTEN_FDS");
+    Environment.unset_variable("LISTEN_FDNAMES");
+    return fd;
+}
+
 int main (string[] args) {
     string? source_pipeline = "v4l2src";
     string? caps =
@@ -76,12 +110,15 @@ int main (string[] args) {
         return 1;
     }
 
+    int listen_fd = get_listen_fd();
+
     // Initializing GStreamer
     Gst.init (ref args);
 
     try {
         pipeline = create_videosource(
-            source_pipeline, caps, "/com/stbtester/VideoSource", name);
+            source_pipeline, caps, "/com/stbtester/VideoSource", name,
+            listen_fd);
     }
     catch (Error e) {
         GLib.stderr.printf ("Error: %s", e.message);
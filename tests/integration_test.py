@@ -25,17 +25,20 @@ def tmpdir():
         shutil.rmtree(dir_, ignore_errors=True)
 
 DEFAULT_SOURCE_PIPELINE = 'videotestsrc is-live=true'
+DEFAULT_CAPS = 'video/x-raw,format=RGB,width=320,height=240,framerate=10/1'
 
 
-def pulsevideo_cmdline(source_pipeline=None):
+def pulsevideo_cmdline(source_pipeline=None, caps=None):
     if source_pipeline is None:
         source_pipeline = DEFAULT_SOURCE_PIPELINE
+    if caps is None:
+        caps = DEFAULT_CAPS
     return ['/usr/bin/env',
             'GST_PLUGIN_PATH=%s/../build' % os.path.dirname(__file__),
             'LD_LIBRARY_PATH=%s/../build/' % os.path.dirname(__file__),
             'G_DEBUG=fatal-warnings',
             '%s/../pulsevideo' % os.path.dirname(__file__),
-            '--caps=video/x-raw,format=RGB,width=320,height=240,framerate=10/1',
+            '--caps=%s' % caps,
             '--source-pipeline=%s' % source_pipeline,
             '--bus-name-suffix=test']
 
@@ -69,9 +72,10 @@ def shquote(l):
 
 
 @contextmanager
-def pulsevideo_ctx(dir_, source_pipeline=None):
+def pulsevideo_ctx(dir_, source_pipeline=None, caps=None):
     with dbus_ctx(dir_) as (dbus_daemon, bus_address):
-        pulsevideod = subprocess.Popen(pulsevideo_cmdline(source_pipeline))
+        pulsevideod = subprocess.Popen(
+            pulsevideo_cmdline(source_pipeline, caps))
         sbus = dbus.bus.BusConnection(bus_address)
         bus = sbus.get_object('org.freedesktop.DBus', '/')
         assert dbus_daemon.poll() is None
@@ -237,6 +241,68 @@ def test_that_pulsevideosrc_recovers_if_pulsevideo_crashes(tmpdir, capfdbinary):
         assert "Error: Internal data stream error." in stderr
 
 
+def test_that_pulsevideosrc_reattaches_as_soon_as_pulsevideo_is_back(tmpdir):
+    with pulsevideo_via_activation(tmpdir) as ctx:
+        cmd = shquote(pulsevideo_cmdline())
+        with open("%s/pulsevideo" % tmpdir, 'w') as f:
+            f.write(dedent("""\
+                #!/bin/bash -ex
+
+                if [ -e {tmpdir}/fail ]; then
+                    # Simulate crash before grabbing bus name
+                    echo >>{tmpdir}/failed-starts
+                    exit 1
+                fi
+                exec {cmd}
+                """.format(tmpdir=tmpdir, cmd=cmd)))
+
+        gst_launch = subprocess.Popen(
+            ['gst-launch-1.0', '-q', 'pulsevideosrc',
+             'bus-name=com.stbtester.VideoSource.test', '!', 'fdsink'],
+            stdout=subprocess.PIPE)
+        fc = FrameCounter(gst_launch.stdout)
+        fc.start()
+        assert wait_until(lambda: fc.count > 5, 20)
+
+        def failed_starts():
+            try:
+                with open('%s/failed-starts' % tmpdir) as f:
+                    return len(f.readlines())
+            except IOError:
+                return 0
+
+        dbus_daemon = ctx.bus.get_object('org.freedesktop.DBus',
+                                         '/org/freedesktop/DBus')
+        open('%s/fail' % tmpdir, 'w').close()
+        os.kill(dbus_daemon.GetConnectionUnixProcessID(
+            'com.stbtester.VideoSource.test'), signal.SIGKILL)
+
+        # Each retry activates pulsevideo again.  The delays back off from
+        # 10ms to between 0.5s and 1s so we should see a handful of retries,
+        # not hundreds:
+        time.sleep(4)
+        assert 5 <= failed_starts() <= 20
+
+        # Bring pulsevideo back straight after a failed retry.  The client
+        # would wait at least another 0.5s before trying again but the bus
+        # name reappearing should wake it up:
+        n = failed_starts()
+        assert wait_until(lambda: failed_starts() > n, 2)
+        os.remove('%s/fail' % tmpdir)
+        count = fc.count
+        dbus_daemon.StartServiceByName('com.stbtester.VideoSource.test',
+                                       dbus.UInt32(0))
+        start = time.time()
+        assert wait_until(lambda: fc.count > count, 5)
+        gap = time.time() - start
+
+        gst_launch.kill()
+        gst_launch.wait()
+
+    print "Reattached %.3fs after pulsevideo came back" % gap
+    assert gap < 0.3
+
+
 def test_that_pulsevideosrc_fails_if_pulsevideo_is_not_available(
         dbus_fixture):
     os.environ['GST_DEBUG'] = "3,*videosource*:9"
@@ -264,6 +330,44 @@ def test_that_pulsevideosrc_gets_eos_if_pulsevideo_crashes_and_cant_be_activated
     assert gst_launch.returncode == 0
 
 
+def test_that_pulsevideosrc_switches_to_the_standby_if_pulsevideo_crashes(
+        pulsevideo):
+    standby = subprocess.Popen(
+        pulsevideo_cmdline()[:-1] + ['--bus-name-suffix=standby'])
+    bus = pulsevideo.bus.get_object('org.freedesktop.DBus', '/')
+    assert wait_until(
+        lambda: 'com.stbtester.VideoSource.standby' in bus.ListNames())
+
+    gst_launch = subprocess.Popen(
+        ['gst-launch-1.0', '-q', 'pulsevideosrc',
+         'bus-name=com.stbtester.VideoSource.test',
+         'standby-bus-name=com.stbtester.VideoSource.standby', '!', 'fdsink'],
+        stdout=subprocess.PIPE)
+    fc = FrameCounter(gst_launch.stdout)
+    fc.start()
+    assert wait_until(lambda: fc.count > 10)
+
+    # The standby is attached but idle: the server isn't sending it anything
+    source = dbus.Interface(
+        pulsevideo.bus.get_object('com.stbtester.VideoSource.standby',
+                                  '/com/stbtester/VideoSource'),
+        'com.stbtester.VideoSource2')
+    assert wait_until(lambda: len(source.GetClientStats()) == 1)
+    assert 'bytes-sent' not in source.GetClientStats()[0]
+
+    # Neither can be activated, so without the standby we'd get EOS:
+    pulsevideo.pulsevideod.kill()
+    count = fc.count
+    assert wait_until(lambda: fc.count > count + 5, 1)
+    assert gst_launch.poll() is None
+
+    # Nothing left to switch to:
+    standby.kill()
+    standby.wait()
+    assert wait_until(lambda: gst_launch.poll() is not None, 2)
+    assert gst_launch.returncode == 0
+
+
 def test_that_pulsevideo_doesnt_leak_fds(pulsevideo):
     gst_launch = subprocess.Popen(
         ['gst-launch-1.0', '-q', 'pulsevideosrc',
@@ -353,6 +457,36 @@ def test_that_invalid_sized_buffers_are_dropped(tmpdir):
                    for x in buffers)
 
 
+def test_that_inline_send_delivers_frames_intact(dbus_fixture):
+    _, bus_address = dbus_fixture
+    server = subprocess.Popen(
+        ['gst-launch-1.0', '-q', 'videotestsrc', 'is-live=true',
+         'pattern=white', '!', DEFAULT_CAPS, '!', 'pulsevideosink',
+         'bus-name=com.stbtester.VideoSource.test', 'caps=%s' % DEFAULT_CAPS,
+         'inline-send=true'])
+    try:
+        bus = dbus.bus.BusConnection(bus_address).get_object(
+            'org.freedesktop.DBus', '/')
+        assert wait_until(
+            lambda: 'com.stbtester.VideoSource.test' in bus.ListNames())
+
+        try:
+            subprocess.check_output(
+                ['gst-launch-1.0', '-q', 'pulsevideosrc',
+                 'bus-name=com.stbtester.VideoSource.test',
+                 '!', 'identity', 'error-after=51',
+                 '!', 'checksumsink'])
+        except subprocess.CalledProcessError as e:
+            output = e.output
+        buffers = [x.split() for x in output.strip().split('\n')]
+        assert len(buffers) == 50
+        assert all(x[1] == 'b2fa672f8bba0b9c504e83c5b17ac848f0c14977'
+                   for x in buffers)
+    finally:
+        server.kill()
+        server.wait()
+
+
 def test_that_teardown_succeeds_during_error_recovery(tmpdir):
     with pulsevideo_via_activation(tmpdir):
         cmd = shquote(pulsevideo_cmdline())
@@ -421,3 +555,229 @@ def test_that_timestamps_are_preserved(tmpdir):
         # The caps specify framerate=1/10, so there should be exactly 0.1s
         # between frames
         assert abs(timestamps[n] + 0.1 - timestamps[n + 1]) < 1e-9
+
+
+def test_that_max_framerate_limits_frames_sent(pulsevideo):
+    # pulsevideo is serving 10 fps, we only want 2:
+    gst_launch = subprocess.Popen(
+        ['gst-launch-1.0', '-q', 'pulsevideosrc',
+         'bus-name=com.stbtester.VideoSource.test', 'max-framerate=2/1', '!',
+         'fdsink'],
+        stdout=subprocess.PIPE)
+    fc = FrameCounter(gst_launch.stdout)
+    fc.start()
+    assert wait_until(lambda: fc.count > 0)
+    start_count = fc.count
+    time.sleep(3)
+    count = fc.count - start_count
+    gst_launch.kill()
+    gst_launch.wait()
+    assert 4 <= count <= 8
+
+
+def test_that_pulsevideosrc_reports_latency_stats(pulsevideo):
+    from gi.repository import Gst
+    Gst.init([])
+    pipeline = Gst.parse_launch(
+        'pulsevideosrc name=src bus-name=com.stbtester.VideoSource.test '
+        'stats-interval=200000000 ! appsink name=appsink')
+    appsink = pipeline.get_by_name('appsink')
+    pipeline.set_state(Gst.State.PLAYING)
+    for _ in range(5):
+        assert appsink.emit("pull-sample")
+
+    stats = pipeline.get_by_name('src').get_property('stats')
+    assert stats.get_value('frames') >= 5
+    assert 0 < stats.get_value('latency-min')
+    assert stats.get_value('latency-min') <= stats.get_value('latency-p50')
+    assert stats.get_value('latency-p50') <= stats.get_value('latency-p99')
+    assert stats.get_value('latency-p99') <= stats.get_value('latency-max')
+    assert stats.get_value('latency-max') < Gst.SECOND
+
+    msg = pipeline.get_bus().timed_pop_filtered(
+        5 * Gst.SECOND, Gst.MessageType.ELEMENT)
+    pipeline.set_state(Gst.State.NULL)
+    assert msg
+    assert msg.get_structure().get_name() == 'pulsevideosrc-stats'
+
+
+def test_that_pulsevideosrc_reports_stats_while_stalled(pulsevideo):
+    from gi.repository import Gst
+    Gst.init([])
+    # Nobody pulls from appsink so no frames get through after the first few
+    pipeline = Gst.parse_launch(
+        'pulsevideosrc name=src bus-name=com.stbtester.VideoSource.test '
+        'stats-interval=200000000 ! appsink max-buffers=1')
+    pipeline.set_state(Gst.State.PLAYING)
+    pipeline.get_state(5 * Gst.SECOND)
+    time.sleep(1)
+
+    frames = []
+    for _ in range(2):
+        msg = pipeline.get_bus().timed_pop_filtered(
+            5 * Gst.SECOND, Gst.MessageType.ELEMENT)
+        assert msg
+        assert msg.get_structure().get_name() == 'pulsevideosrc-stats'
+        frames.append(msg.get_structure().get_value('frames'))
+    pipeline.set_state(Gst.State.NULL)
+    assert frames[0] == frames[1]
+
+
+def test_that_mailbox_mode_drops_stale_frames_for_slow_consumers(pulsevideo):
+    from gi.repository import Gst
+    Gst.init([])
+    pipeline = Gst.parse_launch(
+        'pulsevideosrc name=src bus-name=com.stbtester.VideoSource.test '
+        'mailbox=true ! appsink name=appsink max-buffers=1 sync=false')
+    src = pipeline.get_by_name('src')
+    appsink = pipeline.get_by_name('appsink')
+    pipeline.set_state(Gst.State.PLAYING)
+    assert appsink.emit("pull-sample")
+
+    # pulsevideo is serving 10 fps.  We're too slow for that:
+    time.sleep(1)
+    assert src.get_property('dropped') > 0
+
+    # The frames queued in appsink and the one blocked pushing to it are
+    # stale, but after that we're straight back to the newest:
+    for _ in range(3):
+        sample = appsink.emit("pull-sample")
+    now = pipeline.get_clock().get_time() - pipeline.get_base_time()
+    pipeline.set_state(Gst.State.NULL)
+    assert now - sample.get_buffer().pts < 300 * Gst.MSECOND
+
+
+def test_that_client_stats_are_published_on_dbus(pulsevideo):
+    gst_launch = subprocess.Popen(
+        ['gst-launch-1.0', '-q', 'pulsevideosrc',
+         'bus-name=com.stbtester.VideoSource.test', '!', 'fdsink'],
+        stdout=subprocess.PIPE)
+    fc = FrameCounter(gst_launch.stdout)
+    fc.start()
+    assert wait_until(lambda: fc.count > 5)
+
+    source = dbus.Interface(
+        pulsevideo.bus.get_object('com.stbtester.VideoSource.test',
+                                  '/com/stbtester/VideoSource'),
+        'com.stbtester.VideoSource2')
+    stats = source.GetClientStats()
+    gst_launch.kill()
+    gst_launch.wait()
+
+    assert len(stats) == 1
+    assert stats[0]['pid'] == gst_launch.pid
+    assert stats[0]['bytes-sent'] > 0
+    assert sum(stats[0]['send-latency-histogram']) > 0
+
+
+def test_that_first_frame_is_sent_on_attach(tmpdir):
+    # A frame every 2 seconds, so without burst-on-connect we would typically
+    # wait a second for the first one:
+    with pulsevideo_ctx(
+            tmpdir, caps=DEFAULT_CAPS.replace('framerate=10/1',
+                                              'framerate=1/2')):
+        time.sleep(3)
+        start = time.time()
+        gst_launch = subprocess.Popen(
+            ['gst-launch-1.0', '-q', 'pulsevideosrc',
+             'bus-name=com.stbtester.VideoSource.test', '!', 'fdsink'],
+            stdout=subprocess.PIPE)
+        fc = FrameCounter(gst_launch.stdout)
+        fc.start()
+        assert wait_until(lambda: fc.count > 0, 2)
+        time_to_first_frame = time.time() - start
+        gst_launch.kill()
+        gst_launch.wait()
+    assert time_to_first_frame < 1
+
+
+def test_that_concurrent_attaches_are_served_in_parallel(tmpdir):
+    # Attach before the first frame has been produced so that every call has
+    # to wait for caps.  Served one after another this would take 10 times as
+    # long as a single attach.
+    with pulsevideo_ctx(tmpdir) as ctx:
+        results = []
+
+        def attach():
+            source = dbus.Interface(
+                ctx.bus.get_object('com.stbtester.VideoSource.test',
+                               '/com/stbtester/VideoSource'),
+                'com.stbtester.VideoSource2')
+            start = time.time()
+            socket_, caps = source.Attach({})
+            results.append((time.time() - start, str(caps)))
+            os.close(socket_.take())
+
+        threads = [threading.Thread(target=attach) for _ in range(10)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+    assert len(results) == 10
+    assert all(caps.startswith('video/x-raw') for _, caps in results)
+    assert max(t for t, _ in results) < 5
+
+
+def test_that_many_clients_recover_quickly_after_a_crash(tmpdir):
+    n_clients = 100
+
+    with pulsevideo_via_activation(tmpdir) as ctx:
+        pipeline = ['gst-launch-1.0', '-q']
+        for _ in range(n_clients):
+            pipeline += ['pulsevideosrc',
+                         'bus-name=com.stbtester.VideoSource.test', '!',
+                         'fakesink', 'sync=false']
+        gst_launch = subprocess.Popen(pipeline)
+
+        dbus_daemon = ctx.bus.get_object('org.freedesktop.DBus',
+                                         '/org/freedesktop/DBus')
+
+        def streaming_clients():
+            try:
+                source = dbus.Interface(
+                    ctx.bus.get_object('com.stbtester.VideoSource.test',
+                                       '/com/stbtester/VideoSource'),
+                    'com.stbtester.VideoSource2')
+                return len([s for s in source.GetClientStats()
+                            if s['bytes-sent'] > 0])
+            except dbus.DBusException:
+                return 0
+
+        assert wait_until(lambda: streaming_clients() == n_clients, 30)
+
+        os.kill(dbus_daemon.GetConnectionUnixProcessID(
+            'com.stbtester.VideoSource.test'), signal.SIGKILL)
+        start = time.time()
+        assert wait_until(lambda: streaming_clients() == n_clients, 30)
+        recovery_time = time.time() - start
+
+        gst_launch.kill()
+        gst_launch.wait()
+
+    print "%i clients recovered in %.2fs" % (n_clients, recovery_time)
+    assert recovery_time < 10
+
+
+def test_that_clients_can_attach_without_dbus(pulsevideo):
+    import struct
+
+    source = pulsevideo.bus.get_object('com.stbtester.VideoSource.test',
+                                       '/com/stbtester/VideoSource')
+    address = source.Get('com.stbtester.VideoSource2', 'DirectAddress',
+                         dbus_interface='org.freedesktop.DBus.Properties')
+    assert address
+
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.settimeout(5)
+    s.connect('\0' + str(address))
+    # AttachRequest with no options:
+    s.sendall(struct.pack('=IId', 0x41545448, 0, 0.))
+    magic, caps_len = struct.unpack('=II', s.recv(8, socket.MSG_WAITALL))
+    assert magic == 0x43415053
+    caps = s.recv(caps_len, socket.MSG_WAITALL)
+    assert caps.startswith('video/x-raw')
+
+    # Followed by FDMessages:
+    assert len(s.recv(24, socket.MSG_WAITALL)) == 24
+    s.close()
@@ -0,0 +1,67 @@
+#!/usr/bin/python
+
+from __future__ import division, unicode_literals
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from measure_common import percentile, setup, start_server, stop_server
+
+BUS_NAME = 'com.stbtester.VideoSource.measure_attach'
+OBJECT_PATH = '/com/stbtester/VideoSource'
+CAPS = 'video/x-raw,format=RGB,width=1280,height=720,framerate=30/1'
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description="Measure how long it takes to attach to pulsevideosink "
+                    "through DBus and over its listening socket")
+    parser.add_argument('--attaches', type=int, default=200)
+    args = parser.parse_args(argv[1:])
+
+    version = setup()
+
+    server = start_server(BUS_NAME, CAPS)
+    try:
+        for name, attach in [('dbus', attach_dbus), ('direct', attach_direct)]:
+            times = []
+            for _ in range(args.attaches):
+                start = time.time()
+                attach()
+                times.append(time.time() - start)
+            print "%s %s median %.2f ms p99 %.2f ms" % (
+                version, name, percentile(times, 50) * 1000,
+                percentile(times, 99) * 1000)
+    finally:
+        stop_server(server)
+
+    return 0
+
+
+def attach_dbus():
+    """What pulsevideosrc does: create a proxy, loading its properties, then
+    call Attach."""
+    import dbus
+    bus = dbus.SessionBus()
+    source = bus.get_object(BUS_NAME, OBJECT_PATH)
+    source.GetAll('com.stbtester.VideoSource2',
+                  dbus_interface='org.freedesktop.DBus.Properties')
+    fd, _ = source.Attach({}, dbus_interface='com.stbtester.VideoSource2')
+    os.close(fd.take())
+
+
+def attach_direct():
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.connect('\0pulsevideo/%s%s' % (BUS_NAME, OBJECT_PATH))
+    s.sendall(struct.pack('=IId', 0x41545448, 0, 0.))
+    _, caps_len = struct.unpack('=II', s.recv(8, socket.MSG_WAITALL))
+    s.recv(caps_len, socket.MSG_WAITALL)
+    s.close()
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,73 @@
+#!/usr/bin/python
+
+from __future__ import division, unicode_literals
+
+import argparse
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from measure_common import setup, start_server, stop_server
+
+BUS_NAME = 'com.stbtester.VideoSource.measure_faults'
+CAPS = 'video/x-raw,format=RGB,width=1280,height=720,framerate=60/1'
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description="Measure minor page faults per frame taken by the thread "
+                    "downstream of pulsevideosrc that first reads each frame")
+    parser.add_argument('--frames', type=int, default=600)
+    args = parser.parse_args(argv[1:])
+
+    version = setup()
+
+    server = start_server(BUS_NAME, CAPS)
+    try:
+        for prefetch in ['false', 'true']:
+            faults = measure(prefetch, args.frames)
+            print "%s prefetch=%s %.1f faults/frame" % (
+                version, prefetch, faults)
+    finally:
+        stop_server(server)
+
+    return 0
+
+
+def thread_minflt():
+    # Field 10 of /proc/<pid>/task/<tid>/stat; the comm field before it may
+    # contain spaces.
+    with open('/proc/thread-self/stat') as f:
+        return int(f.read().rsplit(')', 1)[1].split()[7])
+
+
+def measure(prefetch, frames):
+    """Returns the mean number of minor faults per frame taken by the
+    streaming thread after the queue.  videoconvert reads every page of every
+    frame there, like an analysis thread would."""
+    from gi.repository import Gst
+    Gst.init([])
+
+    faults = []
+    pipeline = Gst.parse_launch(
+        'pulsevideosrc name=src bus-name=%s prefetch=%s ! queue '
+        '! videoconvert ! video/x-raw,format=GRAY8 '
+        '! fakesink name=sink sync=false signal-handoffs=true'
+        % (BUS_NAME, prefetch))
+
+    def on_handoff(_sink, _buf, _pad):
+        faults.append(thread_minflt())
+
+    pipeline.get_by_name('sink').connect('handoff', on_handoff)
+    pipeline.set_state(Gst.State.PLAYING)
+    while len(faults) < frames:
+        time.sleep(0.1)
+    pipeline.set_state(Gst.State.NULL)
+
+    # Ignore the first second while everything is warming up:
+    faults = faults[60:]
+    return (faults[-1] - faults[0]) / (len(faults) - 1)
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
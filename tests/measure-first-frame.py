@@ -0,0 +1,66 @@
+#!/usr/bin/python
+
+from __future__ import division, unicode_literals
+
+import argparse
+import os
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from measure_common import percentile, setup, start_server, stop_server
+
+BUS_NAME = 'com.stbtester.VideoSource.measure_first_frame'
+CAPS = 'video/x-raw,format=RGB,width=1280,height=720,framerate=2/1'
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description="Measure the time from starting pulsevideosrc to it "
+                    "producing its first frame")
+    parser.add_argument('--attaches', type=int, default=20)
+    args = parser.parse_args(argv[1:])
+
+    version = setup()
+
+    for burst_latest in [0, 1]:
+        times = measure('burst-latest=%i' % burst_latest, args.attaches)
+        print "%s burst-latest=%i median %.1f ms max %.1f ms" % (
+            version, burst_latest, percentile(times, 50) * 1000,
+            max(times) * 1000)
+
+    return 0
+
+
+def measure(sink_properties, attaches):
+    """Returns the time in seconds from setting a pulsevideosrc pipeline to
+    PLAYING until its first frame reaches the sink, for `attaches` fresh
+    pipelines."""
+    from gi.repository import Gst
+    Gst.init([])
+
+    server = start_server(BUS_NAME, CAPS, sink_properties)
+    times = []
+    for _ in range(attaches):
+        pipeline = Gst.parse_launch(
+            'pulsevideosrc bus-name=%s ! fakesink name=sink sync=false '
+            'signal-handoffs=true' % BUS_NAME)
+        got_frame = threading.Event()
+        pipeline.get_by_name('sink').connect(
+            'handoff', lambda *_: got_frame.set())
+
+        start = time.time()
+        pipeline.set_state(Gst.State.PLAYING)
+        got_frame.wait()
+        times.append(time.time() - start)
+        pipeline.set_state(Gst.State.NULL)
+
+        # Don't always attach at the same point in the frame interval:
+        time.sleep(0.37)
+
+    stop_server(server)
+    return times
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
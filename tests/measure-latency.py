@@ -0,0 +1,64 @@
+#!/usr/bin/python
+
+from __future__ import division, unicode_literals
+
+import argparse
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from measure_common import percentile, setup, start_server, stop_server
+
+BUS_NAME = 'com.stbtester.VideoSource.measure_latency'
+CAPS = 'video/x-raw,format=RGB,width=1280,height=720,framerate=60/1'
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description="Measure capture-to-receive latency of pulsevideo frames")
+    parser.add_argument('--frames', type=int, default=600)
+    args = parser.parse_args(argv[1:])
+
+    version = setup()
+
+    for inline_send in ['false', 'true']:
+        latencies = measure(
+            'inline-send=%s' % inline_send, args.frames)
+        print "%s inline-send=%s median %.1f us p99 %.1f us" % (
+            version, inline_send, percentile(latencies, 50) / 1000,
+            percentile(latencies, 99) / 1000)
+
+    return 0
+
+
+def measure(sink_properties, frames):
+    """Returns the capture-to-receive latency in ns of the next `frames` frames.
+    pulsevideosrc timestamps buffers with the capture time, so the latency is
+    the running time at which a buffer reaches the sink minus its PTS."""
+    from gi.repository import Gst
+    Gst.init([])
+
+    server = start_server(BUS_NAME, CAPS, sink_properties)
+    latencies = []
+    pipeline = Gst.parse_launch(
+        'pulsevideosrc bus-name=%s ! fakesink name=sink sync=false '
+        'signal-handoffs=true' % BUS_NAME)
+
+    def on_handoff(sink, buf, _pad):
+        now = pipeline.get_clock().get_time() - pipeline.get_base_time()
+        latencies.append(now - buf.pts)
+
+    pipeline.get_by_name('sink').connect('handoff', on_handoff)
+    pipeline.set_state(Gst.State.PLAYING)
+    while len(latencies) < frames:
+        time.sleep(0.1)
+    pipeline.set_state(Gst.State.NULL)
+
+    stop_server(server)
+
+    # Ignore the first second while everything is warming up:
+    return latencies[60:]
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,79 @@
+#!/usr/bin/python
+
+from __future__ import division, unicode_literals
+
+import argparse
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from integration_test import pulsevideo_via_activation, wait_until
+from measure_common import percentile, setup
+
+FRAME_SIZE = 320 * 240 * 3
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description="Measure the gap in the video a pulsevideosrc client sees "
+                    "while pulsevideo is killed and DBus activated again")
+    parser.add_argument('--restarts', type=int, default=10)
+    args = parser.parse_args(argv[1:])
+
+    version = setup()
+
+    gaps = measure(args.restarts)
+    print "%s restart gap median %.1f ms max %.1f ms" % (
+        version, percentile(gaps, 50) * 1000, max(gaps) * 1000)
+
+    return 0
+
+
+def measure(restarts):
+    """Returns the longest time in seconds between two frames arriving at a
+    client around each of `restarts` crashes of pulsevideo.  Frames are sent
+    at 10fps so 0.1s would mean that the client didn't notice."""
+    tmpdir = tempfile.mkdtemp(prefix='pulsevideo-measure-restart-gap-')
+    try:
+        with pulsevideo_via_activation(tmpdir) as ctx:
+            client = subprocess.Popen(
+                ['gst-launch-1.0', '-q', 'pulsevideosrc',
+                 'bus-name=com.stbtester.VideoSource.test', '!', 'fdsink'],
+                stdout=subprocess.PIPE)
+            arrivals = []
+
+            def read_frames():
+                while len(client.stdout.read(FRAME_SIZE)) == FRAME_SIZE:
+                    # GIL makes this thread safe :)
+                    arrivals.append(time.time())
+
+            reader = threading.Thread(target=read_frames)
+            reader.daemon = True
+            reader.start()
+            assert wait_until(lambda: len(arrivals) > 10, 20)
+
+            dbus_daemon = ctx.bus.get_object('org.freedesktop.DBus',
+                                             '/org/freedesktop/DBus')
+            gaps = []
+            for _ in range(restarts):
+                n = len(arrivals)
+                os.kill(dbus_daemon.GetConnectionUnixProcessID(
+                    'com.stbtester.VideoSource.test'), signal.SIGKILL)
+                assert wait_until(lambda: len(arrivals) > n + 10, 20)
+                window = arrivals[n - 1:]
+                gaps.append(max(b - a for a, b in zip(window, window[1:])))
+
+            client.kill()
+            client.wait()
+    finally:
+        shutil.rmtree(tmpdir, ignore_errors=True)
+    return gaps
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
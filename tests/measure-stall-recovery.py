@@ -0,0 +1,76 @@
+#!/usr/bin/python
+
+from __future__ import division, unicode_literals
+
+import argparse
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from measure_common import percentile, setup, start_server, stop_server
+
+BUS_NAME = 'com.stbtester.VideoSource.measure_stall_recovery'
+CAPS = 'video/x-raw,format=RGB,width=1280,height=720,framerate=60/1'
+STALL_FRAME = 120
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description="Measure how long capture-to-receive latency takes to "
+                    "recover after the client pipeline stalls")
+    parser.add_argument('--stall', type=float, default=0.5,
+                        help="How long to stall for in seconds")
+    args = parser.parse_args(argv[1:])
+
+    version = setup()
+
+    server = start_server(BUS_NAME, CAPS)
+    try:
+        for drain in ['false', 'true']:
+            baseline, recovery, dropped = measure(drain, args.stall)
+            print ("%s drain=%s baseline %.1f ms recovered after %.1f ms "
+                   "dropped %i" % (version, drain, baseline / 1e6,
+                                   recovery * 1000, dropped))
+    finally:
+        stop_server(server)
+
+    return 0
+
+
+def measure(drain, stall):
+    """Stalls the client's streaming thread for `stall` seconds on frame
+    STALL_FRAME.  Returns the median latency in ns before the stall, the
+    time in seconds from the end of the stall until latency is back within
+    twice that, and the number of frames pulsevideosrc dropped."""
+    from gi.repository import Gst
+    Gst.init([])
+
+    frames = []  # (wall time, latency)
+    pipeline = Gst.parse_launch(
+        'pulsevideosrc name=src bus-name=%s drain=%s ! fakesink name=sink '
+        'sync=false signal-handoffs=true' % (BUS_NAME, drain))
+
+    def on_handoff(_sink, buf, _pad):
+        now = pipeline.get_clock().get_time() - pipeline.get_base_time()
+        frames.append((time.time(), now - buf.pts))
+        if len(frames) == STALL_FRAME:
+            time.sleep(stall)
+
+    pipeline.get_by_name('sink').connect('handoff', on_handoff)
+    pipeline.set_state(Gst.State.PLAYING)
+    while len(frames) < STALL_FRAME + 300:
+        time.sleep(0.1)
+    dropped = pipeline.get_by_name('src').get_property('dropped')
+    pipeline.set_state(Gst.State.NULL)
+
+    # Ignore the first second while everything is warming up:
+    baseline = percentile([l for _, l in frames[60:STALL_FRAME]], 50)
+    stall_end = frames[STALL_FRAME][0]
+    for t, latency in frames[STALL_FRAME:]:
+        if latency <= 2 * baseline:
+            return baseline, t - stall_end, dropped
+    return baseline, float('inf'), dropped
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
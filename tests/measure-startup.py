@@ -0,0 +1,56 @@
+#!/usr/bin/python
+
+from __future__ import division, unicode_literals
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from integration_test import pulsevideo_via_activation
+from measure_common import percentile, setup
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description="Measure the time from a client causing pulsevideo to be "
+                    "DBus activated to it receiving the first frame from "
+                    "videotestsrc")
+    parser.add_argument('--runs', type=int, default=10)
+    args = parser.parse_args(argv[1:])
+
+    version = setup()
+
+    times = [measure() for _ in range(args.runs)]
+    print "%s activation to first frame median %.1f ms max %.1f ms" % (
+        version, percentile(times, 50) * 1000, max(times) * 1000)
+
+    return 0
+
+
+def measure():
+    """Returns the time in seconds from starting a client until it has
+    received its first frame, with a fresh bus and pulsevideo not yet running.
+    This includes the client's own startup which we can't separate out."""
+    tmpdir = tempfile.mkdtemp(prefix='pulsevideo-measure-startup-')
+    try:
+        with pulsevideo_via_activation(tmpdir):
+            start = time.time()
+            client = subprocess.Popen(
+                ['gst-launch-1.0', '-q', 'pulsevideosrc',
+                 'bus-name=com.stbtester.VideoSource.test', '!', 'fdsink'],
+                stdout=subprocess.PIPE)
+            client.stdout.read(1)
+            elapsed = time.time() - start
+            client.kill()
+            client.wait()
+    finally:
+        shutil.rmtree(tmpdir, ignore_errors=True)
+    return elapsed
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,39 @@
+"""Shared by the tests/measure-*.py scripts, which are run from the top of the
+source tree."""
+
+from __future__ import division, unicode_literals
+
+import os
+import subprocess
+import sys
+import time
+
+
+def setup():
+    """Builds pulsevideo and makes GStreamer use the build.  Returns the
+    version being measured to print with the results."""
+    subprocess.check_call(['make'], stdout=sys.stderr)
+    version = subprocess.check_output(['git', 'describe', '--always']).strip()
+
+    os.environ['GST_PLUGIN_PATH'] = os.path.abspath('build')
+    os.environ['LD_LIBRARY_PATH'] = os.path.abspath('build')
+    return version
+
+
+def start_server(bus_name, caps, sink_properties=''):
+    server = subprocess.Popen(
+        ['gst-launch-1.0', '-q', 'videotestsrc', 'is-live=true', '!', caps,
+         '!', 'pulsevideosink', 'bus-name=%s' % bus_name, 'caps=%s' % caps] +
+        sink_properties.split(), stdout=sys.stderr)
+    time.sleep(1)
+    return server
+
+
+def stop_server(server):
+    server.kill()
+    server.wait()
+
+
+def percentile(values, pc):
+    values = sorted(values)
+    return values[min(len(values) - 1, len(values) * pc // 100)]
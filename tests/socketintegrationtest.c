@@ -18,7 +18,10 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 
 #include <gio/gio.h>
@@ -27,11 +30,17 @@
 #include <gst/app/gstappsrc.h>
 #include <gio/gunixfdmessage.h>
 #include "../build/gstnetcontrolmessagemeta.h"
+#include "../build/tmpfile/wire-protocol.h"
 
 #include "sys/types.h"
 #include "sys/stat.h"
 #include "fcntl.h"
 
+/* Since Linux 5.14 */
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
 #define GST_UNREF(x) \
   do { \
     if ( x ) \
@@ -511,6 +520,572 @@ GST_START_TEST (test_that_buffers_from_fddepay_are_read_only)
 
 GST_END_TEST
 
+GST_START_TEST (test_that_multisocketsink_keeps_latency_stats_per_priority)
+{
+  GstPipeline *pipeline;
+  GstElement *sink;
+  GstAppSrc *src;
+  GSocket *high[2] = { NULL, NULL }, *low[2] = { NULL, NULL };
+  GstStructure *options, *stats;
+  gchar data[5];
+  guint64 n;
+  gint i;
+
+  pipeline = GST_PIPELINE (gst_parse_launch (
+      "appsrc name=src format=GST_FORMAT_TIME do-timestamp=true "
+      "! pvmultisocketsink name=sink sync=false enable-last-sample=false",
+      NULL));
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  src = GST_APP_SRC (gst_bin_get_by_name (GST_BIN (pipeline), "src"));
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_PLAYING);
+
+  fail_unless (g_socketpair (G_SOCKET_FAMILY_UNIX,
+          G_SOCKET_TYPE_STREAM | SOCK_CLOEXEC, G_SOCKET_PROTOCOL_DEFAULT,
+          high, NULL));
+  fail_unless (g_socketpair (G_SOCKET_FAMILY_UNIX,
+          G_SOCKET_TYPE_STREAM | SOCK_CLOEXEC, G_SOCKET_PROTOCOL_DEFAULT,
+          low, NULL));
+
+  g_signal_emit_by_name (sink, "add", high[1], NULL);
+  options = gst_structure_new ("options", "priority", G_TYPE_STRING, "low",
+      NULL);
+  g_signal_emit_by_name (sink, "add-with-options", low[1], options, NULL);
+  gst_structure_free (options);
+
+  for (i = 0; i < 10; i++) {
+    fail_unless (gst_app_src_push_buffer (src,
+            gst_buffer_new_wrapped (g_strdup ("hello"), 5)) == GST_FLOW_OK);
+    fail_unless (g_socket_receive (high[0], data, 5, NULL, NULL) == 5);
+    fail_unless (g_socket_receive (low[0], data, 5, NULL, NULL) == 5);
+  }
+
+  g_object_get (sink, "priority-stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint64 (stats, "high-buffers", &n));
+  fail_unless_equals_uint64 (n, 10);
+  fail_unless (gst_structure_get_uint64 (stats, "low-buffers", &n));
+  fail_unless_equals_uint64 (n, 10);
+  fail_unless (gst_structure_has_field (stats, "high-mean-latency"));
+  fail_unless (gst_structure_has_field (stats, "low-max-latency"));
+  gst_structure_free (stats);
+
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_NULL);
+  g_clear_object (&high[0]);
+  g_clear_object (&high[1]);
+  g_clear_object (&low[0]);
+  g_clear_object (&low[1]);
+  GST_UNREF (sink);
+  GST_UNREF (src);
+  gst_object_unref (pipeline);
+}
+
+GST_END_TEST
+
+static GstBuffer *
+buffer_with_pts (const gchar * data, GstClockTime pts)
+{
+  GstBuffer *buf = gst_buffer_new_wrapped (g_strdup (data), strlen (data));
+  GST_BUFFER_PTS (buf) = pts;
+  return buf;
+}
+
+GST_START_TEST (test_that_multisocketsink_skips_stale_buffers)
+{
+  GstPipeline *pipeline;
+  GstElement *sink;
+  GstAppSrc *src;
+  GSocket *sockets[2] = { NULL, NULL };
+  GstStructure *stats;
+  gchar data[5];
+  guint64 n;
+
+  pipeline = GST_PIPELINE (gst_parse_launch (
+      "appsrc name=src format=GST_FORMAT_TIME is-live=true "
+      "! pvmultisocketsink name=sink sync=false enable-last-sample=false "
+      "                    max-frame-age=50000000 burst-latest=1", NULL));
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  src = GST_APP_SRC (gst_bin_get_by_name (GST_BIN (pipeline), "src"));
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_PLAYING);
+  gst_element_get_state (GST_ELEMENT (pipeline), NULL, NULL,
+      GST_CLOCK_TIME_NONE);
+
+  fail_unless (g_socketpair (G_SOCKET_FAMILY_UNIX,
+          G_SOCKET_TYPE_STREAM | SOCK_CLOEXEC, G_SOCKET_PROTOCOL_DEFAULT,
+          sockets, NULL));
+
+  /* kept for burst-latest, so 100ms old by the time the client attaches and
+   * would be sent it: */
+  fail_unless (gst_app_src_push_buffer (src,
+          buffer_with_pts ("stale", 0)) == GST_FLOW_OK);
+  g_usleep (100000);
+  g_signal_emit_by_name (sink, "add", sockets[1], NULL);
+
+  fail_unless (gst_app_src_push_buffer (src,
+          buffer_with_pts ("fresh", 40 * GST_MSECOND)) == GST_FLOW_OK);
+
+  fail_unless (g_socket_receive (sockets[0], data, 5, NULL, NULL) == 5);
+  fail_unless (memcmp (data, "fresh", 5) == 0);
+
+  g_signal_emit_by_name (sink, "get-stats", sockets[1], &stats);
+  fail_unless (gst_structure_get_uint64 (stats, "buffers-stale", &n));
+  fail_unless_equals_uint64 (n, 1);
+  gst_structure_free (stats);
+
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_NULL);
+  g_clear_object (&sockets[0]);
+  g_clear_object (&sockets[1]);
+  GST_UNREF (sink);
+  GST_UNREF (src);
+  gst_object_unref (pipeline);
+}
+
+GST_END_TEST
+
+static guint
+push_for (GstAppSrc * src, GstElement * sink, GstClockTime duration)
+{
+  gint64 end = g_get_monotonic_time () + duration / GST_USECOND;
+  guint handles;
+
+  do {
+    fail_unless (gst_app_src_push_buffer (src,
+            gst_buffer_new_allocate (NULL, 65536, NULL)) == GST_FLOW_OK);
+    g_usleep (10000);
+    g_object_get (sink, "num-handles", &handles, NULL);
+  } while (handles > 0 && g_get_monotonic_time () < end);
+  return handles;
+}
+
+GST_START_TEST (test_that_multisocketsink_removes_idle_clients)
+{
+  GstPipeline *pipeline;
+  GstElement *sink;
+  GstAppSrc *src;
+  GSocket *sockets[2] = { NULL, NULL };
+
+  pipeline = GST_PIPELINE (gst_parse_launch (
+      "appsrc name=src format=GST_FORMAT_TIME is-live=true "
+      "! pvmultisocketsink name=sink sync=false enable-last-sample=false",
+      NULL));
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  src = GST_APP_SRC (gst_bin_get_by_name (GST_BIN (pipeline), "src"));
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_PLAYING);
+  gst_element_get_state (GST_ELEMENT (pipeline), NULL, NULL,
+      GST_CLOCK_TIME_NONE);
+
+  fail_unless (g_socketpair (G_SOCKET_FAMILY_UNIX,
+          G_SOCKET_TYPE_STREAM | SOCK_CLOEXEC, G_SOCKET_PROTOCOL_DEFAULT,
+          sockets, NULL));
+  g_signal_emit_by_name (sink, "add", sockets[1], NULL);
+
+  /* Nothing reads from sockets[0] so the writes stop once the socket buffer
+   * is full.  Without a timeout that's fine: */
+  fail_unless_equals_int (push_for (src, sink, 300 * GST_MSECOND), 1);
+
+  g_object_set (sink, "timeout", 100 * GST_MSECOND, NULL);
+  fail_unless_equals_int (push_for (src, sink, GST_SECOND), 0);
+
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_NULL);
+  g_clear_object (&sockets[0]);
+  g_clear_object (&sockets[1]);
+  GST_UNREF (sink);
+  GST_UNREF (src);
+  gst_object_unref (pipeline);
+}
+
+GST_END_TEST
+
+GST_START_TEST (test_that_adaptive_limits_are_reported_in_stats)
+{
+  GstPipeline *pipeline;
+  GstElement *sink;
+  GstAppSrc *src;
+  GSocket *sockets[2] = { NULL, NULL };
+  GstStructure *stats;
+  gchar data[5];
+  gint i, soft_max, max;
+
+  pipeline = GST_PIPELINE (gst_parse_launch (
+      "appsrc name=src format=GST_FORMAT_TIME "
+      "! pvmultisocketsink name=sink sync=false enable-last-sample=false "
+      "                    buffers-max=4 buffers-soft-max=3 "
+      "                    recover-policy=latest adaptive-limits=true", NULL));
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  src = GST_APP_SRC (gst_bin_get_by_name (GST_BIN (pipeline), "src"));
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_PLAYING);
+
+  fail_unless (g_socketpair (G_SOCKET_FAMILY_UNIX,
+          G_SOCKET_TYPE_STREAM | SOCK_CLOEXEC, G_SOCKET_PROTOCOL_DEFAULT,
+          sockets, NULL));
+  g_signal_emit_by_name (sink, "add", sockets[1], NULL);
+
+  /* A client that keeps up with a 100fps stream: */
+  for (i = 0; i < 30; i++) {
+    fail_unless (gst_app_src_push_buffer (src,
+            buffer_with_pts ("hello", i * 10 * GST_MSECOND)) == GST_FLOW_OK);
+    fail_unless (g_socket_receive (sockets[0], data, 5, NULL, NULL) == 5);
+    g_usleep (10000);
+  }
+
+  g_signal_emit_by_name (sink, "get-stats", sockets[1], &stats);
+  fail_unless (gst_structure_get_int (stats, "buffers-soft-max", &soft_max));
+  fail_unless (gst_structure_get_int (stats, "buffers-max", &max));
+  gst_structure_free (stats);
+
+  /* It shouldn't be given all the slack allowed by the global limits: */
+  fail_unless (soft_max >= 1 && soft_max < 3);
+  fail_unless (max > soft_max && max <= 4);
+
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_NULL);
+  g_clear_object (&sockets[0]);
+  g_clear_object (&sockets[1]);
+  GST_UNREF (sink);
+  GST_UNREF (src);
+  gst_object_unref (pipeline);
+}
+
+GST_END_TEST
+
+GST_START_TEST (test_that_multisocketsink_only_sends_with_credit)
+{
+  GstPipeline *pipeline;
+  GstElement *sink;
+  GstAppSrc *src;
+  GSocket *sockets[2] = { NULL, NULL };
+  GstStructure *options, *stats;
+  CreditMessage credit = { CREDIT_MESSAGE_MAGIC, 2 };
+  gchar data[5];
+  gint i, n;
+
+  pipeline = GST_PIPELINE (gst_parse_launch (
+      "appsrc name=src format=GST_FORMAT_TIME "
+      "! pvmultisocketsink name=sink sync=false enable-last-sample=false",
+      NULL));
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  src = GST_APP_SRC (gst_bin_get_by_name (GST_BIN (pipeline), "src"));
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_PLAYING);
+
+  fail_unless (g_socketpair (G_SOCKET_FAMILY_UNIX,
+          G_SOCKET_TYPE_STREAM | SOCK_CLOEXEC, G_SOCKET_PROTOCOL_DEFAULT,
+          sockets, NULL));
+  options = gst_structure_new ("options", "credit", G_TYPE_BOOLEAN, TRUE,
+      NULL);
+  g_signal_emit_by_name (sink, "add-with-options", sockets[1], options);
+  gst_structure_free (options);
+
+  for (i = 0; i < 3; i++)
+    fail_unless (gst_app_src_push_buffer (src,
+            buffer_with_pts ("hello", i * 10 * GST_MSECOND)) == GST_FLOW_OK);
+
+  /* Nothing is sent before the client grants credit: */
+  g_usleep (100000);
+  fail_unless (g_socket_condition_check (sockets[0], G_IO_IN) == 0);
+
+  fail_unless (g_socket_send (sockets[0], (const gchar *) &credit,
+          sizeof (credit), NULL, NULL) == sizeof (credit));
+  for (i = 0; i < 2; i++) {
+    fail_unless (g_socket_receive (sockets[0], data, 5, NULL, NULL) == 5);
+    fail_unless (memcmp (data, "hello", 5) == 0);
+  }
+
+  /* and the third buffer waits for more credit: */
+  g_usleep (100000);
+  fail_unless (g_socket_condition_check (sockets[0], G_IO_IN) == 0);
+
+  g_signal_emit_by_name (sink, "get-stats", sockets[1], &stats);
+  fail_unless (gst_structure_get_int (stats, "credit", &n));
+  fail_unless_equals_int (n, 0);
+  fail_unless (gst_structure_get_int (stats, "buffers-queued", &n));
+  fail_unless_equals_int (n, 1);
+  gst_structure_free (stats);
+
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_NULL);
+  g_clear_object (&sockets[0]);
+  g_clear_object (&sockets[1]);
+  GST_UNREF (sink);
+  GST_UNREF (src);
+  gst_object_unref (pipeline);
+}
+
+GST_END_TEST
+
+GST_START_TEST (test_that_socketsrc_drains_to_the_newest_message)
+{
+  GstPipeline *pipeline;
+  GstElement *src;
+  GstAppSink *sink;
+  GSocket *sockets[2] = { NULL, NULL };
+  GSocketControlMessage *msg;
+  GOutputVector vec;
+  GstSample *sample;
+  gchar data = '1';
+  guint64 dropped = 0;
+  gint i, devnull;
+
+  fail_unless (g_socketpair (G_SOCKET_FAMILY_UNIX,
+          G_SOCKET_TYPE_STREAM | SOCK_CLOEXEC, G_SOCKET_PROTOCOL_DEFAULT,
+          sockets, NULL));
+
+  /* A backlog of 3 messages, each with an fd like from fdpay: */
+  for (i = 0; i < 3; i++, data++) {
+    devnull = open ("/dev/null", O_RDONLY);
+    msg = g_unix_fd_message_new ();
+    g_unix_fd_message_append_fd ((GUnixFDMessage *) msg, devnull, NULL);
+    close (devnull);
+    vec.buffer = &data;
+    vec.size = 1;
+    fail_unless (g_socket_send_message (sockets[1], NULL, &vec, 1, &msg, 1, 0,
+            NULL, NULL) == 1);
+    g_object_unref (msg);
+  }
+
+  pipeline = GST_PIPELINE (gst_parse_launch (
+      "pvsocketsrc name=src drain=true ! appsink name=sink sync=false",
+      NULL));
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  sink = GST_APP_SINK (gst_bin_get_by_name (GST_BIN (pipeline), "sink"));
+  g_object_set (src, "socket", sockets[0], NULL);
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_PLAYING);
+
+  /* Only the newest is pushed: */
+  sample = gst_app_sink_pull_sample (sink);
+  fail_unless (sample != NULL);
+  fail_unless (gst_buffer_memcmp (gst_sample_get_buffer (sample), 0, "3",
+          1) == 0);
+  fail_unless (gst_buffer_get_meta (gst_sample_get_buffer (sample),
+          GST_NET_CONTROL_MESSAGE_META_API_TYPE) != NULL);
+  gst_sample_unref (sample);
+
+  g_object_get (src, "dropped", &dropped, NULL);
+  fail_unless_equals_int (dropped, 2);
+
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_NULL);
+  g_clear_object (&sockets[0]);
+  g_clear_object (&sockets[1]);
+  GST_UNREF (sink);
+  GST_UNREF (src);
+  gst_object_unref (pipeline);
+}
+
+GST_END_TEST
+
+/* We can't tell from here whether io_uring was actually used, but we should
+ * receive the same either way */
+GST_START_TEST (test_that_socketsrc_receives_the_same_with_io_uring)
+{
+  GstPipeline *pipeline;
+  GstElement *src;
+  GstAppSink *sink;
+  GSocket *sockets[2] = { NULL, NULL };
+  GSocketControlMessage *msg;
+  GOutputVector vec;
+  GstSample *sample;
+  gchar data = '1';
+  gint i, devnull;
+
+  fail_unless (g_socketpair (G_SOCKET_FAMILY_UNIX,
+          G_SOCKET_TYPE_STREAM | SOCK_CLOEXEC, G_SOCKET_PROTOCOL_DEFAULT,
+          sockets, NULL));
+
+  pipeline = GST_PIPELINE (gst_parse_launch (
+      "pvsocketsrc name=src io-uring=true blocksize=1 "
+      "! appsink name=sink sync=false", NULL));
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  sink = GST_APP_SINK (gst_bin_get_by_name (GST_BIN (pipeline), "sink"));
+  g_object_set (src, "socket", sockets[0], NULL);
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_PLAYING);
+
+  for (i = 0; i < 3; i++, data++) {
+    devnull = open ("/dev/null", O_RDONLY);
+    msg = g_unix_fd_message_new ();
+    g_unix_fd_message_append_fd ((GUnixFDMessage *) msg, devnull, NULL);
+    close (devnull);
+    vec.buffer = &data;
+    vec.size = 1;
+    fail_unless (g_socket_send_message (sockets[1], NULL, &vec, 1, &msg, 1, 0,
+            NULL, NULL) == 1);
+    g_object_unref (msg);
+
+    sample = gst_app_sink_pull_sample (sink);
+    fail_unless (sample != NULL);
+    fail_unless (gst_buffer_memcmp (gst_sample_get_buffer (sample), 0, &data,
+            1) == 0);
+    fail_unless (gst_buffer_get_meta (gst_sample_get_buffer (sample),
+            GST_NET_CONTROL_MESSAGE_META_API_TYPE) != NULL);
+    gst_sample_unref (sample);
+  }
+
+  g_socket_shutdown (sockets[1], FALSE, TRUE, NULL);
+  fail_unless (gst_app_sink_pull_sample (sink) == NULL);
+  fail_unless (gst_app_sink_is_eos (sink));
+
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_NULL);
+  g_clear_object (&sockets[0]);
+  g_clear_object (&sockets[1]);
+  GST_UNREF (sink);
+  GST_UNREF (src);
+  gst_object_unref (pipeline);
+}
+
+GST_END_TEST
+
+/* Sends an FDMessage for @size bytes of @fd like fdpay would */
+static void
+send_fd_message (GSocket * socket, gint fd, gsize size)
+{
+  GSocketControlMessage *msg;
+  GOutputVector vec;
+  FDMessage fdmsg = { 0, 0, size };
+
+  msg = g_unix_fd_message_new ();
+  g_unix_fd_message_append_fd ((GUnixFDMessage *) msg, fd, NULL);
+  vec.buffer = &fdmsg;
+  vec.size = sizeof (fdmsg);
+  fail_unless (g_socket_send_message (socket, NULL, &vec, 1, &msg, 1, 0,
+          NULL, NULL) == sizeof (fdmsg));
+  g_object_unref (msg);
+}
+
+GST_START_TEST (test_that_writable_fddepay_buffers_are_copy_on_write)
+{
+  GstPipeline *pipeline;
+  GstElement *src;
+  GstAppSink *sink;
+  GSocket *sockets[2] = { NULL, NULL };
+  GstSample *sample;
+  GstBuffer *buf;
+  GstMemory *mem;
+  GstMapInfo info;
+  gchar data[5];
+  gint fd;
+
+  fail_unless (g_socketpair (G_SOCKET_FAMILY_UNIX,
+          G_SOCKET_TYPE_STREAM | SOCK_CLOEXEC, G_SOCKET_PROTOCOL_DEFAULT,
+          sockets, NULL));
+
+  fd = g_file_open_tmp (NULL, NULL, NULL);
+  fail_unless (fd >= 0);
+  fail_unless (write (fd, "hello", 5) == 5);
+  send_fd_message (sockets[1], fd, 5);
+
+  pipeline = GST_PIPELINE (gst_parse_launch (
+      "pvsocketsrc name=src blocksize=24 ! pvfddepay writable=true "
+      "! appsink name=sink sync=false enable-last-sample=false", NULL));
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  g_object_set (src, "socket", sockets[0], NULL);
+  sink = GST_APP_SINK (gst_bin_get_by_name (GST_BIN (pipeline), "sink"));
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_PLAYING);
+
+  sample = gst_app_sink_pull_sample (sink);
+  fail_unless (sample != NULL);
+  buf = gst_buffer_ref (gst_sample_get_buffer (sample));
+  gst_sample_unref (sample);
+
+  /* Writing to the frame doesn't need a copy... */
+  fail_unless (gst_buffer_is_writable (buf));
+  mem = gst_buffer_peek_memory (buf, 0);
+  fail_unless (gst_buffer_map (buf, &info, GST_MAP_READWRITE));
+  fail_unless (gst_buffer_peek_memory (buf, 0) == mem);
+  info.data[0] = 'j';
+  gst_buffer_unmap (buf, &info);
+  fail_unless (gst_buffer_memcmp (buf, 0, "jello", 5) == 0);
+
+  /* ...and doesn't modify the sender's memory either */
+  fail_unless (pread (fd, data, 5, 0) == 5);
+  fail_unless (memcmp (data, "hello", 5) == 0);
+
+  gst_buffer_unref (buf);
+  close (fd);
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_NULL);
+  g_clear_object (&sockets[0]);
+  g_clear_object (&sockets[1]);
+  GST_UNREF (sink);
+  GST_UNREF (src);
+  gst_object_unref (pipeline);
+}
+
+GST_END_TEST
+
+static glong
+minor_faults (void)
+{
+  struct rusage usage;
+
+  fail_unless (getrusage (RUSAGE_SELF, &usage) == 0);
+  return usage.ru_minflt;
+}
+
+GST_START_TEST (test_that_fddepay_prefetches_frames)
+{
+  GstPipeline *pipeline;
+  GstElement *src;
+  GstAppSink *sink;
+  GSocket *sockets[2] = { NULL, NULL };
+  GstSample *sample;
+  GstMapInfo info;
+  const gsize size = 4 * 1024 * 1024;
+  gsize pagesize = sysconf (_SC_PAGESIZE), i;
+  gchar *data;
+  void *probe;
+  gboolean can_populate;
+  glong faults;
+  gint fd;
+
+  fail_unless (g_socketpair (G_SOCKET_FAMILY_UNIX,
+          G_SOCKET_TYPE_STREAM | SOCK_CLOEXEC, G_SOCKET_PROTOCOL_DEFAULT,
+          sockets, NULL));
+
+  data = g_malloc (size);
+  for (i = 0; i < size; i++)
+    data[i] = i % 251;
+  fd = g_file_open_tmp (NULL, NULL, NULL);
+  fail_unless (fd >= 0);
+  fail_unless (write (fd, data, size) == size);
+  send_fd_message (sockets[1], fd, size);
+  close (fd);
+
+  /* Older kernels only get MADV_WILLNEED, which leaves the page tables
+   * to be filled in by faults */
+  probe = mmap (NULL, pagesize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  fail_unless (probe != MAP_FAILED);
+  can_populate = madvise (probe, pagesize, MADV_POPULATE_READ) == 0;
+  munmap (probe, pagesize);
+
+  pipeline = GST_PIPELINE (gst_parse_launch (
+      "pvsocketsrc name=src blocksize=24 ! pvfddepay prefetch=true "
+      "! appsink name=sink sync=false enable-last-sample=false", NULL));
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  g_object_set (src, "socket", sockets[0], NULL);
+  sink = GST_APP_SINK (gst_bin_get_by_name (GST_BIN (pipeline), "sink"));
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_PLAYING);
+
+  sample = gst_app_sink_pull_sample (sink);
+  fail_unless (sample != NULL);
+  fail_unless (gst_buffer_map (gst_sample_get_buffer (sample), &info,
+          GST_MAP_READ));
+  fail_unless_equals_int (info.size, size);
+
+  /* Reading every page of the frame shouldn't fault in the pages one (or
+   * with fault-around, 16) at a time */
+  faults = minor_faults ();
+  fail_unless (memcmp (info.data, data, size) == 0);
+  faults = minor_faults () - faults;
+  if (can_populate)
+    fail_unless (faults < size / pagesize / 64, "%li faults", faults);
+
+  gst_buffer_unmap (gst_sample_get_buffer (sample), &info);
+  gst_sample_unref (sample);
+
+  g_free (data);
+  gst_element_set_state (GST_ELEMENT (pipeline), GST_STATE_NULL);
+  g_clear_object (&sockets[0]);
+  g_clear_object (&sockets[1]);
+  GST_UNREF (sink);
+  GST_UNREF (src);
+  gst_object_unref (pipeline);
+}
+
+GST_END_TEST
+
 static Suite *
 socketintegrationtest_suite (void)
 {
@@ -532,6 +1107,23 @@ socketintegrationtest_suite (void)
       test_that_fdpay_attaches_a_monotonic_timestamp);
   tcase_add_test (tc_chain,
       test_that_buffers_from_fddepay_are_read_only);
+  tcase_add_test (tc_chain,
+      test_that_multisocketsink_keeps_latency_stats_per_priority);
+  tcase_add_test (tc_chain,
+      test_that_multisocketsink_skips_stale_buffers);
+  tcase_add_test (tc_chain,
+      test_that_multisocketsink_removes_idle_clients);
+  tcase_add_test (tc_chain,
+      test_that_adaptive_limits_are_reported_in_stats);
+  tcase_add_test (tc_chain,
+      test_that_multisocketsink_only_sends_with_credit);
+  tcase_add_test (tc_chain,
+      test_that_socketsrc_drains_to_the_newest_message);
+  tcase_add_test (tc_chain,
+      test_that_socketsrc_receives_the_same_with_io_uring);
+  tcase_add_test (tc_chain,
+      test_that_writable_fddepay_buffers_are_copy_on_write);
+  tcase_add_test (tc_chain, test_that_fddepay_prefetches_frames);
 
   return s;
 }